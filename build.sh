@@ -22,10 +22,19 @@ fi
 echo "Compiling with $compiler..."
 if $compiler -std=c++20 -O2 -flto \
     src/arguments.cpp \
+    src/cell_pool.cpp \
     src/memory_cell.cpp \
+    src/child_index.cpp \
+    src/memory_image.cpp \
+    src/mapped_file.cpp \
+    src/checkpoint.cpp \
+    src/literal_pool.cpp \
     src/tokenizer.cpp \
     src/program.cpp \
     src/instruction_block.cpp \
+    src/bytecode.cpp \
+    src/jit.cpp \
+    src/cpp_emitter.cpp \
     src/instructions/nullary.cpp \
     src/instructions/unary.cpp \
     src/instructions/set_memory.cpp \
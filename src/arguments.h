@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include "definitions.h"
 #include "program_state.h"
@@ -13,8 +14,15 @@ namespace Arguments {
     protected:
         static ProgramState* state;
     public:
+        // which of the subclasses an argument is, for code which doesn't call get() (see bytecode.h)
+        enum struct Kind : std::uint8_t {
+            CONSTANT,
+            ACCUMULATOR,
+            MEMORY_CELL,
+        };
         virtual ~Argument() {}
         virtual num get() = 0;
+        virtual Kind kind() const = 0;
         static void setStatePtr(ProgramState* _state) { state = _state; }
     };
 
@@ -25,6 +33,7 @@ namespace Arguments {
         Constant(num _value) : value(_value) {}
         ~Constant() {}
         num get();
+        Kind kind() const { return Kind::CONSTANT; }
     };
 
     class Accumulator : public Argument {
@@ -32,6 +41,7 @@ namespace Arguments {
         Accumulator() {}
         ~Accumulator() {}
         num get();
+        Kind kind() const { return Kind::ACCUMULATOR; }
     };
 
     class MemoryCell : public Argument {
@@ -39,6 +49,7 @@ namespace Arguments {
         MemoryCell() {}
         ~MemoryCell() {}
         num get();
+        Kind kind() const { return Kind::MEMORY_CELL; }
     };
 }
 
@@ -0,0 +1,476 @@
+// bytecode.cpp
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include "definitions.h"
+#include "program_state.h"
+#include "memory_cell.h"
+#include "cell_pool.h"
+#include "arguments.h"
+#include "checkpoint.h"
+#include "instruction_container.h"
+#include "instruction_block.h"
+#include "instruction_node.h"
+#include "bytecode.h"
+using namespace spherehorn;
+using Kind = Arguments::Argument::Kind;
+
+namespace {
+    std::uint8_t skipBits(Condition condition) {
+        switch (condition) {
+        case Condition::WHEN_TRUE:
+            return Bytecode::SKIP_WHEN_FALSE;
+        case Condition::WHEN_FALSE:
+            return Bytecode::SKIP_WHEN_TRUE;
+        default:
+            return 0;
+        }
+    }
+
+    // whether the memory might need tidying after an instruction
+    bool usesMemory(Bytecode::Op op) {
+        using Op = Bytecode::Op;
+        switch (op) {
+        case Op::End:
+        case Op::Increment:
+        case Op::Decrement:
+        case Op::Invert:
+            return false;
+        case Op::SetMemoryVal:
+            return true;
+        default:
+            return op < Op::SetAccumulator || op > Op::NotEqual;
+        }
+    }
+}
+
+Bytecode::Bytecode(InstructionBlock& program) {
+    program.compile(*this);
+    if (!openBlocks_.empty()) throw std::logic_error("bytecode has a block which was never ended");
+}
+
+void Bytecode::emit(const InstructionNode& node) {
+    add({node.op, skipBits(node.condition), node.operand, node.value, 0, &node});
+}
+
+void Bytecode::beginBlock(Condition condition) {
+    std::uint32_t block = static_cast<std::uint32_t>(blocks_.size());
+    Instruction instr {Op::Block, skipBits(condition), Kind::CONSTANT, 0, 0, nullptr};
+    if (openBlocks_.empty()) {
+        // the top-level block isn't inside anything
+        code_.push_back(instr);
+        locations_.push_back({block, 0});
+    } else {
+        add(instr);
+    }
+    blocks_.push_back({static_cast<std::uint32_t>(code_.size() - 1), {}, 0, nullptr});
+    openBlocks_.push_back(block);
+}
+
+void Bytecode::endBlock() {
+    std::uint32_t block = openBlocks_.back();
+    openBlocks_.pop_back();
+    const BlockInfo& info = blocks_[block];
+    if (info.starts.empty()) throw std::runtime_error("a block has no instructions");
+    code_.push_back({Op::Jump, 0, Kind::CONSTANT, 0, info.starts.front(), nullptr});
+    locations_.push_back({block, 0});
+
+    // the End is where the block finishes, so breaking out of the block or skipping it goes there
+    std::uint32_t end = static_cast<std::uint32_t>(code_.size());
+    code_[info.start].target = end;
+    for (std::uint32_t pc = info.start + 1; pc < end; pc++) {
+        // the breaks out of any blocks inside this one already have their targets
+        if (code_[pc].op == Op::Break && code_[pc].target == 0) code_[pc].target = end;
+    }
+    // the top-level block finishing is the end of the program
+    code_.push_back({openBlocks_.empty() ? Op::Exit : Op::End, 0, Kind::CONSTANT, 0, 0, nullptr});
+    locations_.push_back({block, 0});
+}
+
+void Bytecode::add(const Instruction& instr) {
+    BlockInfo& info = blocks_[openBlocks_.back()];
+    locations_.push_back({openBlocks_.back(), static_cast<std::uint32_t>(info.starts.size())});
+    info.starts.push_back(static_cast<std::uint32_t>(code_.size()));
+    code_.push_back(instr);
+}
+
+Status Bytecode::run(ProgramState& state) {
+    std::uint32_t pc = 0;
+    if (state.isResuming()) {
+        pc = resumePoint(state);
+        state.position.clear();
+        state.resumeDepth = 0;
+    }
+    recording_ = NOT_RECORDING;
+    num acc = state.accRegister;
+    bool cond = state.condRegister;
+    MemoryCell* memoryPtr = state.memoryPtr;
+    std::uint64_t untilCheckpoint = state.untilCheckpoint;
+    const CellPool& cellPool = MemoryCell::pool();
+    // the registers only live in state while something other than this loop might use them
+    auto store = [&state, &acc, &cond, &memoryPtr, &untilCheckpoint]() {
+        state.accRegister = acc;
+        state.condRegister = cond;
+        state.memoryPtr = memoryPtr;
+        state.untilCheckpoint = untilCheckpoint;
+    };
+    auto load = [&state, &acc, &cond, &memoryPtr]() {
+        acc = state.accRegister;
+        cond = state.condRegister;
+        memoryPtr = state.memoryPtr;
+    };
+    // hand an instruction back to the node it was lowered from
+    auto runSource = [&state, &store, &load](const Instruction& instr) {
+        store();
+        Status result = instr.source->run(*instr.source, state);
+        load();
+        return result;
+    };
+    // Carry out an instruction which isn't skipped, other than one which moves around the program.
+    // Returns OKAY if the program carries on. It's inlined into both the loop below and the one for
+    // traces, since otherwise the registers can't be kept out of memory.
+    auto execute = [&acc, &cond, &memoryPtr, &store, &runSource](const Instruction& instr) __attribute__((always_inline)) {
+        num arg = instr.operand == Kind::CONSTANT ? instr.value :
+                  instr.operand == Kind::ACCUMULATOR ? acc :
+                  memoryPtr->getVal();
+        switch (instr.op) {
+        case Op::End:
+            break;
+
+        // when any of these would fail, its source is left to report the error
+        case Op::Increment:
+            acc++;
+            break;
+        case Op::Decrement:
+            if (acc == 0) return runSource(instr);
+            acc--;
+            break;
+        case Op::Invert:
+            cond = !cond;
+            break;
+        case Op::MemoryUp:
+            memoryPtr = memoryPtr->ascend();
+            if (memoryPtr->isTop()) {
+                store();
+                return Status::EXIT;
+            }
+            break;
+        case Op::MemoryDown:
+            if (memoryPtr->getVal() == 0) return runSource(instr);
+            memoryPtr = memoryPtr->getChild();
+            break;
+        case Op::MemoryPrev:
+            memoryPtr = memoryPtr->getPrev();
+            break;
+        case Op::MemoryNext:
+            memoryPtr = memoryPtr->getNext();
+            break;
+        case Op::MemoryRestart:
+            memoryPtr = memoryPtr->getParent()->getChild();
+            break;
+        case Op::MemoryRotate:
+            memoryPtr->makeFirst();
+            break;
+        case Op::SetAccumulator:
+            acc = arg;
+            break;
+        case Op::SetConditional:
+            cond = arg;
+            break;
+        case Op::SetMemoryVal:
+            memoryPtr->setVal(arg);
+            break;
+        case Op::Add:
+            acc += arg;
+            break;
+        case Op::Subtract:
+            if (arg > acc) return runSource(instr);
+            acc -= arg;
+            break;
+        case Op::ReverseSubtract:
+            if (acc > arg) return runSource(instr);
+            acc = arg - acc;
+            break;
+        case Op::Multiply:
+            acc = toNum(wide_num{acc} * arg);
+            break;
+        case Op::Divide:
+            if (arg == 0) return runSource(instr);
+            acc /= arg;
+            break;
+        case Op::ReverseDivide:
+            if (acc == 0) return runSource(instr);
+            acc = arg / acc;
+            break;
+        case Op::Modulo:
+            if (arg == 0) return runSource(instr);
+            acc %= arg;
+            break;
+        case Op::ReverseModulo:
+            if (acc == 0) return runSource(instr);
+            acc = arg % acc;
+            break;
+        case Op::And:
+            cond = cond && arg;
+            break;
+        case Op::Or:
+            cond = cond || arg;
+            break;
+        case Op::Xor:
+            cond = cond != !!arg;
+            break;
+        case Op::Greater:
+            cond = acc > arg;
+            break;
+        case Op::Equal:
+            cond = acc == arg;
+            break;
+        case Op::Less:
+            cond = acc < arg;
+            break;
+        case Op::GreaterOrEqual:
+            cond = acc >= arg;
+            break;
+        case Op::LessOrEqual:
+            cond = acc <= arg;
+            break;
+        case Op::NotEqual:
+            cond = acc != arg;
+            break;
+        case Op::MemoryBack:
+            memoryPtr = memoryPtr->shiftBack(arg);
+            break;
+        case Op::MemoryForward:
+            memoryPtr = memoryPtr->shiftForward(arg);
+            break;
+
+        // input and output, inserting and deleting, and setting memory to a literal
+        default:
+            return runSource(instr);
+        }
+        return Status::OKAY;
+    };
+
+    const Instruction* code = code_.data();
+    while (true) {
+        const Instruction& instr = code[pc];
+        bool isSkipped = (instr.skip & (cond ? SKIP_WHEN_TRUE : SKIP_WHEN_FALSE)) != 0;
+        if (recording_ != NOT_RECORDING) record(pc, isSkipped);
+        if (isSkipped) {
+            // a block which is skipped finishes straight away
+            if (instr.op == Op::Block) {
+                pc = instr.target;
+                continue;
+            }
+        } else {
+            switch (instr.op) {
+            // these move around the program without running anything
+            case Op::Block:
+                pc++;
+                continue;
+            case Op::Break:
+                pc = instr.target;
+                continue;
+            case Op::Exit:
+                store();
+                return Status::EXIT;
+            case Op::Jump: {
+                BlockInfo& block = blocks_[locations_[pc].block];
+                Trace* trace = block.trace.get();
+                if (!trace) {
+                    if (++block.iterations == HOT_ITERATIONS) {
+                        recording_ = locations_[pc].block;
+                        recorded_.clear();
+                    }
+                    pc = instr.target;
+                    continue;
+                }
+
+                // go round the trace for as long as its guards hold, as long as the iteration can
+                // finish before the next checkpoint (otherwise it's left to the loop below, which
+                // suspends at the right instruction)
+                const TraceStep* failed = nullptr;
+                bool hasLooped = false;
+                while (untilCheckpoint > trace->length && !Checkpoint::isRequested) {
+                    for (const TraceStep& step : trace->steps) {
+                        if (step.guard != Guard::NONE && cond != (step.guard == Guard::WHEN_TRUE)) {
+                            failed = &step;
+                            break;
+                        }
+                        // the step is only a guard
+                        if (step.instr.op == Op::End) continue;
+                        if (Status result = execute(step.instr); result != Status::OKAY) return result;
+                        if (step.usesMemory) {
+                            memoryPtr = InstructionBlock::tidyMemory(memoryPtr);
+                            if (cellPool.isOverLimit() && InstructionBlock::isOverLimit()) {
+                                store();
+                                return Status::ABORT;
+                            }
+                        }
+                    }
+                    if (failed) break;
+                    untilCheckpoint -= trace->length;
+                    hasLooped = true;
+                }
+                if (hasLooped) trace->earlyExits = 0;
+                if (!failed) {
+                    pc = instr.target;
+                    continue;
+                }
+
+                // carry on from the instruction whose guard failed
+                untilCheckpoint -= failed->completed;
+                pc = failed->pc;
+                if (!hasLooped && ++trace->earlyExits == MAX_EARLY_EXITS) {
+                    // the loop doesn't usually go this way any more, so record it again
+                    block.trace.reset();
+                    block.iterations = 0;
+                }
+                continue;
+            }
+            default:
+                if (Status result = execute(instr); result != Status::OKAY) return result;
+                break;
+            }
+        }
+
+        // an instruction has finished, so do what a block does between instructions
+        pc++;
+        memoryPtr = InstructionBlock::tidyMemory(memoryPtr);
+        if (cellPool.isOverLimit() && InstructionBlock::isOverLimit()) {
+            store();
+            return Status::ABORT;
+        }
+        if (--untilCheckpoint == 0 || Checkpoint::isRequested) {
+            store();
+            suspend(pc, state);
+            return Status::SUSPEND;
+        }
+    }
+}
+
+const std::vector<Bytecode::TraceStep>* Bytecode::trace(std::uint32_t block) const {
+    const Trace* trace = blocks_.at(block).trace.get();
+    return trace ? &trace->steps : nullptr;
+}
+
+void Bytecode::record(std::uint32_t pc, bool isSkipped) {
+    const Instruction& instr = code_[pc];
+    if (instr.op == Op::Jump) {
+        // the iteration has come round to the start again
+        compileTrace();
+        recording_ = NOT_RECORDING;
+        return;
+    }
+    // the trace can't follow it into another block or out of this one
+    if ((instr.op == Op::Block || instr.op == Op::Break) && !isSkipped) {
+        // count the loop's iterations again, so that a later one can be recorded instead
+        blocks_[recording_].iterations = 0;
+        recording_ = NOT_RECORDING;
+        return;
+    }
+    recorded_.push_back({pc, isSkipped});
+}
+
+void Bytecode::compileTrace() {
+    auto trace = std::make_unique<Trace>();
+    // what the conditional register is known to be, if anything, at this point in the trace
+    bool isCondKnown = false;
+    bool knownCond = false;
+    for (auto [pc, isSkipped] : recorded_) {
+        const Instruction& instr = code_[pc];
+        Guard guard = Guard::NONE;
+        if (instr.skip != 0) {
+            // whether the register was true, as it must have been to skip or run this the way it did
+            bool wasTrue = ((instr.skip & SKIP_WHEN_TRUE) != 0) == isSkipped;
+            if (!isCondKnown || knownCond != wasTrue) guard = wasTrue ? Guard::WHEN_TRUE : Guard::WHEN_FALSE;
+            isCondKnown = true;
+            knownCond = wasTrue;
+        }
+
+        if (isSkipped || instr.op == Op::End) {
+            // nothing runs, but there might be a guard to check
+            if (guard != Guard::NONE) {
+                trace->steps.push_back({guard, false, {Op::End, 0, Kind::CONSTANT, 0, 0, nullptr}, pc, trace->length});
+            }
+            // skipping a block takes it straight to its End, which finishes instead
+            if (instr.op != Op::Block) trace->length++;
+            continue;
+        }
+        trace->steps.push_back({guard, usesMemory(instr.op), instr, pc, trace->length});
+        trace->length++;
+
+        switch (instr.op) {
+        case Op::Increment:
+        case Op::Decrement:
+        case Op::SetAccumulator:
+        case Op::SetMemoryVal:
+        case Op::Add:
+        case Op::Subtract:
+        case Op::ReverseSubtract:
+        case Op::Multiply:
+        case Op::Divide:
+        case Op::ReverseDivide:
+        case Op::Modulo:
+        case Op::ReverseModulo:
+        case Op::MemoryUp:
+        case Op::MemoryDown:
+        case Op::MemoryPrev:
+        case Op::MemoryNext:
+        case Op::MemoryRestart:
+        case Op::MemoryRotate:
+        case Op::MemoryBack:
+        case Op::MemoryForward:
+            break;
+        case Op::Invert:
+            knownCond = !knownCond;
+            break;
+        case Op::SetConditional:
+            isCondKnown = instr.operand == Kind::CONSTANT;
+            knownCond = instr.value != 0;
+            break;
+        // these can only make it false and true respectively
+        case Op::And:
+            isCondKnown = isCondKnown && !knownCond;
+            break;
+        case Op::Or:
+            isCondKnown = isCondKnown && knownCond;
+            break;
+        // the comparisons, and anything the source runs, could leave it either way
+        default:
+            isCondKnown = false;
+            break;
+        }
+    }
+    blocks_[recording_].trace = std::move(trace);
+}
+
+void Bytecode::suspend(std::uint32_t pc, ProgramState& state) const {
+    // the instruction that runs next is wherever the jumps after this one lead
+    while (code_[pc].op == Op::Jump) pc = code_[pc].target;
+    Location location = locations_[pc];
+    state.position.push_back(location.index);
+    while (location.block != 0) {
+        location = locations_[blocks_[location.block].start];
+        state.position.push_back(location.index);
+    }
+}
+
+std::uint32_t Bytecode::resumePoint(const ProgramState& state) const {
+    const BlockInfo* block = &blocks_.front();
+    std::uint32_t pc = 0;
+    for (std::size_t depth = state.resumeDepth; depth < state.position.size(); depth++) {
+        pc = block->starts.at(state.position[depth]);
+        // Every instruction but the last is a block which was already running. The blocks are in
+        // order of where they start, so we can look this one up by its Block instruction.
+        block = &*std::lower_bound(blocks_.begin(), blocks_.end(), pc, [](const BlockInfo& info, std::uint32_t start) {
+            return info.start < start;
+        });
+    }
+    // jumping straight to the instruction goes back into the blocks around it without checking
+    // their conditions again, as it should
+    return pc;
+}
@@ -0,0 +1,210 @@
+// bytecode.h
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "definitions.h"
+#include "program_state.h"
+#include "arguments.h"
+#include "instruction_container.h"
+
+namespace spherehorn {
+
+struct InstructionNode;
+class InstructionBlock;
+
+// A program lowered from its tree of instructions into a flat list of them, which run() works
+// through in a single loop with the registers kept in local variables.
+//
+// Blocks become jumps. Each block starts with a Block instruction, which skips to the block's End
+// if its condition doesn't hold, and its last instruction is followed by a Jump back to its first.
+// A break is a jump to the End of its block. Each instruction's condition becomes a pair of bits
+// saying whether it's skipped when the conditional register is false and when it's true.
+//
+// Only the instructions which programs run a lot are carried out here. The rest, and the error
+// paths of those that are, are handed back to the node they were lowered from, so the blocks must
+// outlive their bytecode and mustn't change. Between instructions, run() does everything that
+// InstructionBlock::action() does, and it suspends for checkpoints at the same points with the same
+// ProgramState::position, so that a checkpoint saved by either one can be restored by the other.
+//
+// Loops are traced once they get hot. When a block has gone round HOT_ITERATIONS times, run()
+// records which of its instructions the next iteration runs and which it skips, and turns that
+// into a trace: just the instructions which ran, each behind a guard on the conditional register
+// if its condition mattered (and the register might have changed since the last guard). From then
+// on, whenever the block loops, run() goes round the trace instead, until a guard fails and it
+// carries on from that instruction as usual. Recording is abandoned if the iteration enters an
+// inner block or breaks out, and a trace which keeps failing on its first iteration is thrown
+// away and recorded again later. A trace doesn't start an iteration which couldn't finish before
+// the next checkpoint, so checkpoints still happen at the same points, though a requested one
+// waits for the end of the iteration. Traces only tidy the memory after instructions which use it.
+class Bytecode {
+public:
+    // The kinds of instruction, which InstructionNodes are labelled with too. Those other than the
+    // first four are named after the instruction classes they're lowered from, and do the same thing.
+    enum struct Op : std::uint8_t {
+        Block,
+        Jump,
+        End,
+        Exit,
+
+        Break,
+        Increment,
+        Decrement,
+        Invert,
+        InputChar,
+        InputNum,
+        InputString,
+        OutputChar,
+        OutputNum,
+        OutputString,
+        MemoryUp,
+        MemoryDown,
+        MemoryPrev,
+        MemoryNext,
+        MemoryRestart,
+        MemoryRotate,
+        InsertBefore,
+        InsertAfter,
+        DeleteBefore,
+        DeleteAfter,
+
+        SetAccumulator,
+        SetConditional,
+        SetMemoryVal,
+        Add,
+        Subtract,
+        ReverseSubtract,
+        Multiply,
+        Divide,
+        ReverseDivide,
+        Modulo,
+        ReverseModulo,
+        And,
+        Or,
+        Xor,
+        Greater,
+        Equal,
+        Less,
+        GreaterOrEqual,
+        LessOrEqual,
+        NotEqual,
+        MemoryBack,
+        MemoryForward,
+
+        SetMemory,
+    };
+    // the bits of Instruction::skip: whether it's skipped when the conditional register is false,
+    // and when it's true
+    static constexpr std::uint8_t SKIP_WHEN_FALSE = 1;
+    static constexpr std::uint8_t SKIP_WHEN_TRUE = 2;
+
+    static constexpr std::uint32_t HOT_ITERATIONS = 1000;
+    // the number of times in a row that a trace can fail before finishing an iteration before
+    // it's thrown away
+    static constexpr std::uint32_t MAX_EARLY_EXITS = 8;
+
+    struct Instruction {
+        Op op;
+        std::uint8_t skip;
+        // where the argument comes from, if there is one (nullary instructions have a constant 0)
+        Arguments::Argument::Kind operand;
+        // the argument, if it's a constant
+        num value;
+        // Block and Break: the block's End. Jump: where to jump to.
+        std::uint32_t target;
+        // the node this was lowered from, which runs it if it isn't carried out here
+        const InstructionNode* source;
+    };
+    // what the conditional register has to be for a trace to carry on
+    enum struct Guard : std::uint8_t {
+        NONE,
+        WHEN_TRUE,
+        WHEN_FALSE,
+    };
+    struct TraceStep {
+        Guard guard;
+        // whether instr needs the memory tidied after it
+        bool usesMemory;
+        // End, if the step is only a guard
+        Instruction instr;
+        // where instr came from, which is where the interpreter carries on if the guard fails
+        std::uint32_t pc;
+        // the number of instructions which the iteration has finished before this step
+        std::uint32_t completed;
+    };
+
+private:
+    // where an instruction came from: the number of the block it's in (the top-level block is 0,
+    // and the rest are numbered in the order they start) and its index there
+    struct Location {
+        std::uint32_t block;
+        std::uint32_t index;
+    };
+    struct Trace {
+        std::vector<TraceStep> steps;
+        // the number of instructions which an iteration finishes
+        std::uint32_t length = 0;
+        std::uint32_t earlyExits = 0;
+    };
+    struct BlockInfo {
+        // the Block instruction which starts it
+        std::uint32_t start;
+        // where each of the block's own instructions starts, by index
+        std::vector<std::uint32_t> starts;
+        // the number of times it's looped since it was last traced, and its trace if it has one
+        std::uint32_t iterations = 0;
+        std::unique_ptr<Trace> trace;
+    };
+    // no block is being recorded
+    static constexpr std::uint32_t NOT_RECORDING = UINT32_MAX;
+
+    std::vector<Instruction> code_;
+    std::vector<Location> locations_;
+    std::vector<BlockInfo> blocks_;
+    // while lowering: the blocks which have started but not ended yet, innermost last
+    std::vector<std::uint32_t> openBlocks_;
+    // while tracing: the block whose iteration is being recorded, and each instruction it has
+    // reached so far along with whether it ran
+    std::uint32_t recording_ = NOT_RECORDING;
+    std::vector<std::pair<std::uint32_t, bool>> recorded_;
+
+public:
+    // Lower a program's top-level block. Throws std::runtime_error if it contains an empty block.
+    Bytecode(InstructionBlock& program);
+    Bytecode(const Bytecode&) = delete;
+    Bytecode& operator =(const Bytecode&) = delete;
+    // Run the program from the start, or from state.position if it's resuming. The result is the
+    // same as that of the top-level block's run(), except that finishing is EXIT rather than OKAY.
+    Status run(ProgramState& state);
+    const std::vector<Instruction>& instructions() const { return code_; }
+    // Return the trace of a block, numbered as in the order they start, or null if it hasn't got one
+    const std::vector<TraceStep>* trace(std::uint32_t block) const;
+
+    // For InstructionBlock::compile():
+    // Add an instruction lowered from node to the innermost block
+    void emit(const InstructionNode& node);
+    // Start a block inside the innermost one (or the top-level block, if there isn't one yet), and
+    // end the innermost block
+    void beginBlock(Condition condition);
+    void endBlock();
+
+private:
+    friend class Jit;
+    void add(const Instruction& instr);
+    // Fill in state.position for a program which is suspending just before the instruction at pc,
+    // innermost block first, as the blocks of the tree would
+    void suspend(std::uint32_t pc, ProgramState& state) const;
+    // Return where to pick up a program which is resuming from state.position
+    std::uint32_t resumePoint(const ProgramState& state) const;
+    // Add the instruction at pc, which the iteration being recorded has reached, to the recording,
+    // or stop recording if that's as far as it goes
+    void record(std::uint32_t pc, bool isSkipped);
+    // Turn the recording into the trace of its block
+    void compileTrace();
+};
+
+}
@@ -0,0 +1,176 @@
+// cell_pool.cpp
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "cell_pool.h"
+using namespace spherehorn;
+
+
+CellPool::CellPool(std::size_t slotSize, std::size_t regionSlots) :
+    // every slot needs to be able to hold a free list link, and needs to stay aligned for it
+    slotSize_((std::max(slotSize, sizeof(FreeSlot)) + alignof(FreeSlot) - 1) / alignof(FreeSlot) * alignof(FreeSlot)) {
+    if (regionSlots != 0 && !reserveRegion(regionSlots)) throw std::bad_alloc();
+}
+
+CellPool::~CellPool() {
+    if (regionBase_ != nullptr) munmap(regionBase_, regionSize_);
+    if (fileDescriptor_ != -1) close(fileDescriptor_);
+}
+
+void* CellPool::allocate() {
+    numLive_++;
+    if (numLive_ > peakLive_) peakLive_ = numLive_;
+    updatePeak();
+    // prefer recycling a freed slot, since it's probably still in cache
+    if (freeList_ != nullptr) {
+        FreeSlot* slot = freeList_;
+        freeList_ = slot->next;
+        numRecycled_++;
+        return slot;
+    }
+    if (bumpPtr_ == bumpEnd_) addSlab();
+    void* slot = bumpPtr_;
+    bumpPtr_ += slotSize_;
+    return slot;
+}
+
+void CellPool::deallocate(void* ptr) {
+    if (ptr == nullptr) return;
+    numLive_--;
+    // if nothing is using the pool anymore, we can give all of its memory back at once rather than
+    // keeping track of the freed slot
+    if (numLive_ == 0) {
+        releaseSlabs();
+        return;
+    }
+    FreeSlot* slot = static_cast<FreeSlot*>(ptr);
+    slot->next = freeList_;
+    freeList_ = slot;
+}
+
+void CellPool::setLimit(std::size_t limit) {
+    limit_ = limit;
+    limitBytes_ = limit > SIZE_MAX / slotSize_ ? SIZE_MAX : limit * slotSize_;
+    isOverLimit_ = numBytes() > limitBytes_;
+}
+
+void CellPool::sortFreeList() {
+    std::vector<FreeSlot*> slots;
+    for (FreeSlot* slot = freeList_; slot != nullptr; slot = slot->next) slots.push_back(slot);
+    std::stable_sort(slots.begin(), slots.end(), std::less<FreeSlot*>());
+    freeList_ = nullptr;
+    for (auto it = slots.rbegin(); it != slots.rend(); it++) {
+        (*it)->next = freeList_;
+        freeList_ = *it;
+    }
+}
+
+bool CellPool::reserveRegion(std::size_t maxSlots) {
+    if (numLive_ != 0 || hasRegion()) throw std::runtime_error("attempted to reserve a region for a pool which is already in use");
+    return mapRegion(maxSlots, -1);
+}
+
+bool CellPool::mapFile(const std::string& path, std::size_t maxSlots) {
+    if (numLive_ != 0) throw std::runtime_error("attempted to map a file for a pool which is already in use");
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) return false;
+    unlink(path.c_str());
+    // the file's region replaces any anonymous one
+    std::byte* oldBase = regionBase_;
+    std::size_t oldSize = regionSize_;
+    if (!mapRegion(maxSlots, fd)) {
+        close(fd);
+        return false;
+    }
+    if (oldBase != nullptr) munmap(oldBase, oldSize);
+    if (fileDescriptor_ != -1) close(fileDescriptor_);
+    fileDescriptor_ = fd;
+    return true;
+}
+
+bool CellPool::mapRegion(std::size_t maxSlots, int fd) {
+    maxSlots = std::min<std::size_t>(maxSlots, EXTERNAL_BIT);
+    int flags = fd == -1 ? MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE : MAP_SHARED | MAP_NORESERVE;
+    // The kernel may refuse to hand out a very large range (e.g. if overcommit is disabled), so
+    // keep asking for less until it agrees. The pages aren't backed by memory until they're touched.
+    for (std::size_t size = maxSlots / SLAB_SLOTS * slabBytes(); size >= slabBytes(); size /= 2) {
+        void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+        if (base == MAP_FAILED) continue;
+        regionBase_ = static_cast<std::byte*>(base);
+        regionSize_ = size / slabBytes() * slabBytes();
+        return true;
+    }
+    return false;
+}
+
+std::uint32_t CellPool::externalRef(const void* ptr) {
+    auto found = externalRefs_.find(ptr);
+    if (found != externalRefs_.end()) return found->second;
+
+    std::uint32_t ref = 0;
+    if (!freeExternalRefs_.empty()) {
+        ref = freeExternalRefs_.back();
+        freeExternalRefs_.pop_back();
+        externals_[ref & ~EXTERNAL_BIT] = ptr;
+    } else {
+        ref = static_cast<std::uint32_t>(externals_.size()) | EXTERNAL_BIT;
+        externals_.push_back(ptr);
+    }
+    externalRefs_.emplace(ptr, ref);
+    return ref;
+}
+
+void CellPool::forgetExternal(const void* ptr) {
+    auto found = externalRefs_.find(ptr);
+    if (found == externalRefs_.end()) return;
+    externals_[found->second & ~EXTERNAL_BIT] = nullptr;
+    freeExternalRefs_.push_back(found->second);
+    externalRefs_.erase(found);
+}
+
+void CellPool::addSlab() {
+    if (!hasRegion()) {
+        slabs_.emplace_back(new std::byte[slabBytes()]);
+        bumpPtr_ = slabs_.back().get();
+        bumpEnd_ = bumpPtr_ + slabBytes();
+        return;
+    }
+
+    if (regionUsed_ == regionSize_) throw std::bad_alloc();
+    // give the file the disk space for the slab now, since running out of it once the slab's in use
+    // would kill the process
+    if (isFileBacked() && posix_fallocate(fileDescriptor_, static_cast<off_t>(regionUsed_), static_cast<off_t>(slabBytes())) != 0) {
+        throw std::bad_alloc();
+    }
+    bumpPtr_ = regionBase_ + regionUsed_;
+    bumpEnd_ = bumpPtr_ + slabBytes();
+    // the very first slot of the region is never handed out, so that reference 0 can mean null
+    if (regionUsed_ == 0) bumpPtr_ += slotSize_;
+    regionUsed_ += slabBytes();
+}
+
+void CellPool::releaseSlabs() {
+    slabs_.clear();
+    if (hasRegion()) {
+        // keep the address space reserved, but let the kernel reclaim the pages behind it
+        madvise(regionBase_, regionUsed_, MADV_DONTNEED);
+        regionUsed_ = 0;
+        // and give the file's disk space back too (if this fails, it'll just be reused later)
+        if (isFileBacked()) {
+            [[maybe_unused]] int result = ftruncate(fileDescriptor_, 0);
+        }
+    }
+    freeList_ = nullptr;
+    bumpPtr_ = nullptr;
+    bumpEnd_ = nullptr;
+}
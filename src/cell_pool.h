@@ -0,0 +1,148 @@
+// cell_pool.h
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace spherehorn {
+
+// A slab allocator for fixed-size objects (in practice, MemoryCells). Slots are carved out of large
+// slabs, and freed slots are threaded onto a free list so that they can be recycled without going
+// back to the system allocator. Once every slot has been returned, the slabs are released in bulk.
+//
+// A pool can optionally carve its slabs out of a single reserved range of address space (a
+// "region") instead of getting each one from the system allocator. Every slot in a region can then
+// be named by a 29-bit reference, which is what the compact cell layout uses for its links (keeping
+// the top 3 bits of each 32-bit link for tags). Objects which live outside the region (e.g. on the
+// stack) can still be referred to; they're given a reference with EXTERNAL_BIT set, which indexes
+// into a side table.
+//
+// A region can also be backed by a file instead of anonymous memory. The kernel can then write cold
+// pages of a tree which is too big for RAM back to the file, rather than to swap (or killing the
+// process when there is none).
+class CellPool {
+private:
+    // A freed slot is reused to store the link to the next free slot
+    struct FreeSlot {
+        FreeSlot* next;
+    };
+
+    static constexpr std::size_t SLAB_SLOTS = 4096;
+    static constexpr std::uint32_t EXTERNAL_BIT = std::uint32_t(1) << 28;
+
+    std::size_t slotSize_;
+    std::vector<std::unique_ptr<std::byte[]>> slabs_;
+    FreeSlot* freeList_ = nullptr;
+    // the part of the newest slab which hasn't been handed out yet
+    std::byte* bumpPtr_ = nullptr;
+    std::byte* bumpEnd_ = nullptr;
+    std::size_t numLive_ = 0;
+    std::size_t peakLive_ = 0;
+    // memory which the objects in the slots hold outside of the pool (see charge())
+    std::size_t numChargedBytes_ = 0;
+    std::size_t peakBytes_ = 0;
+    std::size_t numRecycled_ = 0;
+    std::size_t limit_ = SIZE_MAX;
+    std::size_t limitBytes_ = SIZE_MAX;
+    bool isOverLimit_ = false;
+    // the reserved region, if any, and how much of it has been handed out as slabs
+    std::byte* regionBase_ = nullptr;
+    std::size_t regionSize_ = 0;
+    std::size_t regionUsed_ = 0;
+    // the file behind the region, or -1 if it's anonymous memory
+    int fileDescriptor_ = -1;
+    // side table for objects outside the region
+    std::vector<const void*> externals_;
+    std::unordered_map<const void*, std::uint32_t> externalRefs_;
+    std::vector<std::uint32_t> freeExternalRefs_;
+
+public:
+    // The most slots that a region can be given references for
+    static constexpr std::size_t MAX_REGION_SLOTS = EXTERNAL_BIT;
+
+    // If regionSlots is nonzero, the pool starts out with a region of that many slots (see
+    // reserveRegion()), and throws std::bad_alloc if it can't get one.
+    CellPool(std::size_t slotSize, std::size_t regionSlots = 0);
+    CellPool(const CellPool&) = delete;
+    CellPool& operator =(const CellPool&) = delete;
+    ~CellPool();
+    // Return an uninitialized slot of slotSize bytes
+    void* allocate();
+    // Return a slot to the pool. If it was the last live slot, every slab is freed.
+    void deallocate(void* ptr);
+    constexpr std::size_t slotSize() const { return slotSize_; }
+    constexpr std::size_t numLive() const { return numLive_; }
+    // the most slots that have ever been live at once
+    constexpr std::size_t peakLive() const { return peakLive_; }
+    // Count memory which the objects in the slots have allocated outside of the pool (e.g. arrays
+    // they point to) as part of the pool's, or stop counting it once it's been freed
+    void charge(std::size_t bytes) {
+        numChargedBytes_ += bytes;
+        updatePeak();
+    }
+    void refund(std::size_t bytes) { numChargedBytes_ -= bytes; }
+    // the bytes in live slots, plus those charged to them
+    constexpr std::size_t numBytes() const { return numLive_ * slotSize_ + numChargedBytes_; }
+    // the most bytes that have ever been in use at once
+    constexpr std::size_t peakBytes() const { return peakBytes_; }
+    // A pool never refuses to allocate, but a caller can set a limit on the memory in use, as a
+    // number of slots' worth of bytes, and check whether it's been exceeded. The allocation (or
+    // charge) which goes over the limit flags it, and the flag stays up until the limit is set
+    // again, so a check after an operation which allocates a lot and then frees most of it still
+    // sees that the limit was exceeded.
+    void setLimit(std::size_t limit);
+    constexpr std::size_t limit() const { return limit_; }
+    constexpr std::size_t limitBytes() const { return limitBytes_; }
+    constexpr bool isOverLimit() const { return isOverLimit_; }
+    std::size_t numSlabs() const { return slabs_.size() + regionUsed_ / slabBytes(); }
+    // the number of allocations which have reused a freed slot, rather than taking the next one in
+    // line, which is a measure of how scattered the slots in use are
+    constexpr std::size_t numRecycled() const { return numRecycled_; }
+    // Sort the free list by address, so that the slots it hands out next are in the same order as
+    // they are in memory
+    void sortFreeList();
+
+    // Reserve address space for up to maxSlots slots, so that every slot allocated from now on can
+    // be named by a 32-bit reference. Returns false if no region could be reserved. This must be
+    // called before the first allocation.
+    bool reserveRegion(std::size_t maxSlots);
+    // Like reserveRegion(), but back the region with a file at the given path, replacing any region
+    // the pool already has. The file is only scratch space: it's created (or truncated) and then
+    // unlinked straight away, so nothing is left behind however the process ends. Returns false if
+    // the file couldn't be created or mapped. This must be called before the first allocation.
+    bool mapFile(const std::string& path, std::size_t maxSlots);
+    constexpr bool hasRegion() const { return regionBase_ != nullptr; }
+    constexpr bool isFileBacked() const { return fileDescriptor_ != -1; }
+    constexpr std::byte* regionBase() const { return regionBase_; }
+    bool inRegion(const void* ptr) const {
+        const std::byte* bytePtr = static_cast<const std::byte*>(ptr);
+        return bytePtr >= regionBase_ && bytePtr < regionBase_ + regionUsed_;
+    }
+    // References 0 through EXTERNAL_BIT - 1 name slots in the region (0 is never allocated, so it
+    // can stand for null); references from EXTERNAL_BIT upwards name objects outside of it.
+    static constexpr bool isExternalRef(std::uint32_t ref) { return (ref & EXTERNAL_BIT) != 0; }
+    std::uint32_t externalRef(const void* ptr);
+    const void* externalAt(std::uint32_t ref) const { return externals_[ref & ~EXTERNAL_BIT]; }
+    // Forget about an object outside the region, e.g. because it's being destroyed
+    void forgetExternal(const void* ptr);
+
+private:
+    constexpr std::size_t slabBytes() const { return SLAB_SLOTS * slotSize_; }
+    // record a new peak in bytes, and whether it's over the limit
+    void updatePeak() {
+        std::size_t bytes = numBytes();
+        if (bytes > peakBytes_) peakBytes_ = bytes;
+        if (bytes > limitBytes_) isOverLimit_ = true;
+    }
+    // map a region of up to maxSlots slots, from the given file or from anonymous memory if fd is -1
+    bool mapRegion(std::size_t maxSlots, int fd);
+    void addSlab();
+    void releaseSlabs();
+};
+
+}
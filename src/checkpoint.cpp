@@ -0,0 +1,72 @@
+// checkpoint.cpp
+
+#include <csignal>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "definitions.h"
+#include "memory_cell.h"
+#include "memory_image.h"
+#include "program_state.h"
+#include "checkpoint.h"
+using namespace spherehorn;
+
+namespace {
+    const std::string MAGIC = "SPHCKPT";
+    const std::uint64_t VERSION = 2;
+}
+
+volatile std::sig_atomic_t Checkpoint::isRequested = 0;
+
+void Checkpoint::save(std::ostream& out, const ProgramState& state, const MemoryCell* memory) {
+    out.write(MAGIC.data(), static_cast<std::streamsize>(MAGIC.size()));
+    MemoryImage::writeNum(out, VERSION);
+    MemoryImage::writeNum(out, state.accRegister);
+    out.put(state.condRegister ? 1 : 0);
+    MemoryImage::writeNum(out, state.position.size());
+    for (unsigned int index : state.position) MemoryImage::writeNum(out, index);
+    out.put(memory == nullptr ? 0 : 1);
+    if (memory != nullptr) MemoryImage::write(out, *memory, state.memoryPtr);
+}
+
+MemoryCell* Checkpoint::load(std::istream& in, ProgramState& state) {
+    std::string magic (MAGIC.size(), '\0');
+    in.read(magic.data(), static_cast<std::streamsize>(magic.size()));
+    if (!in || magic != MAGIC) throw std::runtime_error("not a checkpoint file");
+    if (MemoryImage::readNum(in) != VERSION) throw std::runtime_error("unsupported checkpoint version");
+
+    std::uint64_t acc = MemoryImage::readNum(in);
+    if (acc > num(-1)) throw std::runtime_error("checkpoint's accumulator is out of range");
+    int cond = in.get();
+    if (cond != 0 && cond != 1) throw std::runtime_error("checkpoint is malformed");
+    std::uint64_t depth = MemoryImage::readNum(in);
+    std::vector<unsigned int> position;
+    for (std::uint64_t i = 0; i < depth; i++) {
+        std::uint64_t index = MemoryImage::readNum(in);
+        if (index > unsigned(-1)) throw std::runtime_error("checkpoint is malformed");
+        position.push_back(static_cast<unsigned int>(index));
+    }
+
+    int hasMemory = in.get();
+    if (hasMemory != 0 && hasMemory != 1) throw std::runtime_error("checkpoint is malformed");
+    // a program can't run without memory, or with its memory pointer anywhere but on a cell below the
+    // root
+    if (hasMemory == 0) throw std::runtime_error("checkpoint has no memory");
+    MemoryCell* marked = nullptr;
+    MemoryCell* memory = MemoryImage::read(in, marked);
+    if (marked == nullptr || marked == memory) {
+        delete memory;
+        throw std::runtime_error("checkpoint's memory pointer isn't in its memory");
+    }
+
+    state.accRegister = toNum(acc);
+    state.condRegister = cond == 1;
+    state.position = std::move(position);
+    state.resumeDepth = 0;
+    state.memoryPtr = marked;
+    return memory;
+}
@@ -0,0 +1,33 @@
+// checkpoint.h
+
+#pragma once
+
+#include <csignal>
+#include <istream>
+#include <ostream>
+#include "definitions.h"
+#include "memory_cell.h"
+#include "program_state.h"
+
+namespace spherehorn {
+
+// Saves and loads the state of a running program, so that a long computation can be stopped and
+// picked up again later. A checkpoint holds the registers, the position of the next instruction to
+// run (see ProgramState::position) and the whole memory tree in the format of MemoryImage. It
+// doesn't hold the program itself, so it can only be restored by the same program file.
+class Checkpoint {
+public:
+    // Set when a checkpoint should be taken as soon as possible; running blocks check it between
+    // instructions
+    static volatile std::sig_atomic_t isRequested;
+    // Ask for a checkpoint. This is safe to call from a signal handler.
+    static void request() { isRequested = 1; }
+
+    // Write the program's state and its memory, whose root may be null
+    static void save(std::ostream& out, const ProgramState& state, const MemoryCell* memory);
+    // Read a checkpoint into state, returning the root of its memory. Throws std::runtime_error if
+    // the input isn't a valid checkpoint, or if it has no memory for the program to resume in.
+    static MemoryCell* load(std::istream& in, ProgramState& state);
+};
+
+}
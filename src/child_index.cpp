@@ -0,0 +1,327 @@
+// child_index.cpp
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "definitions.h"
+#include "memory_cell.h"
+#include "child_index.h"
+using namespace spherehorn;
+
+ChildIndex::ChildIndex(num size, num numInstantiated) : size_(size), sparse_(!isDense(size, numInstantiated)) {
+    if (!sparse_) {
+        allocateSlots();
+    } else {
+        // node 0, which stands for a missing node
+        nodes_.push_back(Node{});
+    }
+    updateCharge();
+#ifdef SPHEREHORN_COMPACT_CELLS
+    id_ = IndexLink::add(this);
+#endif
+}
+
+ChildIndex::~ChildIndex() {
+    MemoryCell::pool().refund(chargedBytes_);
+#ifdef SPHEREHORN_COMPACT_CELLS
+    IndexLink::remove(id_);
+#endif
+}
+
+void ChildIndex::set(num pos, MemoryCell* cell) {
+    if (sparse_) {
+        num nodePos = 0;
+        std::uint32_t next = find(pos, nodePos);
+        if (next != 0 && nodePos == pos) {
+            nodes_[next].cell = cell;
+            cell->slot = next;
+            return;
+        }
+        // the new child splits the uninstantiated children before the next one (or the ones after
+        // the last one) in two
+        num gap = pos;
+        if (next != 0) {
+            gap = nodes_[next].gap - (nodePos - pos);
+            nodes_[next].gap = nodePos - pos - 1;
+        } else if (root_ != 0) {
+            gap = pos - nodes_[root_].span;
+        }
+        insertNode(next, cell, gap);
+        // a full dense index always has room for one more child, or it would have become sparse
+        std::size_t numNodes = nodes_.size() - 1 - freeNodes_.size();
+        if (std::size_t{size_} + 8 <= MAX_CAPACITY && isDense(size_, numNodes)) makeDense();
+        return;
+    }
+    place(physical(pos), cell);
+}
+
+void ChildIndex::insert(num pos, MemoryCell* cell) {
+    if (!sparse_ && gapStart_ == gapEnd_ && slots_.size() >= MAX_CAPACITY) makeSparse();
+    size_++;
+    if (sparse_) {
+        // the children at and after pos all move forwards if the first of them does
+        num nodePos = 0;
+        std::uint32_t next = find(pos, nodePos);
+        if (next != 0) {
+            nodes_[next].gap++;
+            updateUp(next);
+        }
+        set(pos, cell);
+        if (first_ >= pos) first_++;
+        return;
+    }
+    if (gapStart_ == gapEnd_) grow();
+    moveGap(pos);
+    place(gapStart_, cell);
+    gapStart_++;
+    // the first child has moved forwards if it was at or after pos
+    if (first_ >= pos) first_++;
+}
+
+void ChildIndex::erase(num pos) {
+    size_--;
+    if (sparse_) {
+        // likewise, the children after pos all move backwards if the first of them does
+        num nodePos = 0;
+        std::uint32_t node = find(pos, nodePos);
+        if (node != 0 && nodePos == pos) {
+            // the uninstantiated children before this one are now before the next one
+            std::uint32_t next = successor(node);
+            if (next != 0) {
+                nodes_[next].gap += nodes_[node].gap;
+                updateUp(next);
+            }
+            removeNode(node);
+        } else if (node != 0) {
+            nodes_[node].gap--;
+            updateUp(node);
+        }
+        if (first_ > pos) first_--;
+        return;
+    }
+    moveGap(pos);
+    // the child at pos is now just after the gap, so widening the gap removes it
+    slots_[gapEnd_] = nullptr;
+    gapEnd_++;
+    if (first_ > pos) first_--;
+}
+
+void ChildIndex::moveGap(num pos) {
+    if (pos < gapStart_) {
+        // move the children in [pos, gapStart_) to the end of the gap, starting from the last one
+        // so that we don't overwrite anything we haven't moved yet
+        num numMoved = gapStart_ - pos;
+        for (num i = numMoved; i > 0; i--) {
+            place(gapEnd_ - numMoved + i - 1, slots_[std::size_t{pos} + i - 1]);
+        }
+        gapStart_ -= numMoved;
+        gapEnd_ -= numMoved;
+    } else if (pos > gapStart_) {
+        // move the children just after the gap to its start
+        num numMoved = pos - gapStart_;
+        for (num i = 0; i < numMoved; i++) {
+            place(gapStart_ + i, slots_[gapEnd_ + i]);
+        }
+        gapStart_ += numMoved;
+        gapEnd_ += numMoved;
+    }
+}
+
+void ChildIndex::grow() {
+    std::size_t oldCapacity = slots_.size();
+    std::size_t numAfterGap = oldCapacity - gapEnd_;
+    std::size_t newCapacity = std::min(std::max<std::size_t>(16, oldCapacity * 2), MAX_CAPACITY);
+    slots_.resize(newCapacity, nullptr);
+    // move everything after the gap to the end of the new array
+    num newGapEnd = toNum(newCapacity - numAfterGap);
+    for (std::size_t i = numAfterGap; i > 0; i--) {
+        place(toNum(newGapEnd + i - 1), slots_[gapEnd_ + i - 1]);
+    }
+    gapEnd_ = newGapEnd;
+    updateCharge();
+}
+
+void ChildIndex::allocateSlots() {
+    std::size_t capacity = std::min(std::size_t{size_} + std::max<std::size_t>(8, size_ / 8), MAX_CAPACITY);
+    slots_.resize(capacity, nullptr);
+    gapStart_ = size_;
+    gapEnd_ = toNum(capacity);
+}
+
+void ChildIndex::makeSparse() {
+    std::vector<std::pair<num, MemoryCell*>> children;
+    forEach([&children](num pos, MemoryCell* child) { children.emplace_back(pos, child); });
+    slots_ = std::vector<CellLink>();
+    gapStart_ = 0;
+    gapEnd_ = 0;
+    sparse_ = true;
+    nodes_.push_back(Node{});
+    for (const auto& [pos, child] : children) set(pos, child);
+    updateCharge();
+}
+
+void ChildIndex::makeDense() {
+    std::vector<std::pair<num, MemoryCell*>> children;
+    forEach([&children](num pos, MemoryCell* child) { children.emplace_back(pos, child); });
+    nodes_ = std::vector<Node>();
+    freeNodes_ = std::vector<std::uint32_t>();
+    root_ = 0;
+    sparse_ = false;
+    allocateSlots();
+    for (const auto& [pos, child] : children) place(pos, child);
+    updateCharge();
+}
+
+void ChildIndex::updateCharge() {
+    std::size_t bytes = sizeof(ChildIndex) + slots_.capacity() * sizeof(CellLink) +
+                        nodes_.capacity() * sizeof(Node) + freeNodes_.capacity() * sizeof(std::uint32_t);
+    if (bytes > chargedBytes_) {
+        MemoryCell::pool().charge(bytes - chargedBytes_);
+    } else {
+        MemoryCell::pool().refund(chargedBytes_ - bytes);
+    }
+    chargedBytes_ = bytes;
+}
+
+void ChildIndex::place(num index, MemoryCell* cell) {
+    slots_[index] = cell;
+    if (cell != nullptr) cell->slot = index;
+}
+
+std::uint32_t ChildIndex::find(num pos, num& nodePos) const {
+    std::uint32_t found = 0;
+    std::uint32_t node = root_;
+    // the position of the first child in node's subtree, less its gap
+    num start = 0;
+    while (node != 0) {
+        const Node& curr = nodes_[node];
+        num currPos = start + nodes_[curr.left].span + curr.gap;
+        if (currPos >= pos) {
+            found = node;
+            nodePos = currPos;
+            node = curr.left;
+        } else {
+            start = currPos + 1;
+            node = curr.right;
+        }
+    }
+    return found;
+}
+
+num ChildIndex::sparsePosition(std::uint32_t node) const {
+    num pos = nodes_[nodes_[node].left].span + nodes_[node].gap;
+    for (std::uint32_t up = nodes_[node].up; up != 0; node = up, up = nodes_[up].up) {
+        if (nodes_[up].right == node) pos += nodes_[nodes_[up].left].span + nodes_[up].gap + 1;
+    }
+    return pos;
+}
+
+std::uint32_t ChildIndex::leftmost(std::uint32_t node) const {
+    if (node == 0) return 0;
+    while (nodes_[node].left != 0) node = nodes_[node].left;
+    return node;
+}
+
+std::uint32_t ChildIndex::successor(std::uint32_t node) const {
+    if (nodes_[node].right != 0) return leftmost(nodes_[node].right);
+    std::uint32_t up = nodes_[node].up;
+    while (up != 0 && nodes_[up].right == node) {
+        node = up;
+        up = nodes_[up].up;
+    }
+    return up;
+}
+
+void ChildIndex::update(std::uint32_t node) {
+    Node& curr = nodes_[node];
+    curr.span = nodes_[curr.left].span + nodes_[curr.right].span + curr.gap + 1;
+}
+
+void ChildIndex::updateUp(std::uint32_t node) {
+    for (; node != 0; node = nodes_[node].up) update(node);
+}
+
+void ChildIndex::rotateUp(std::uint32_t node) {
+    std::uint32_t parent = nodes_[node].up;
+    std::uint32_t grandparent = nodes_[parent].up;
+    // node's inner subtree moves across to parent
+    if (nodes_[parent].left == node) {
+        std::uint32_t inner = nodes_[node].right;
+        nodes_[parent].left = inner;
+        if (inner != 0) nodes_[inner].up = parent;
+        nodes_[node].right = parent;
+    } else {
+        std::uint32_t inner = nodes_[node].left;
+        nodes_[parent].right = inner;
+        if (inner != 0) nodes_[inner].up = parent;
+        nodes_[node].left = parent;
+    }
+    nodes_[parent].up = node;
+    nodes_[node].up = grandparent;
+    if (grandparent == 0) {
+        root_ = node;
+    } else if (nodes_[grandparent].left == parent) {
+        nodes_[grandparent].left = node;
+    } else {
+        nodes_[grandparent].right = node;
+    }
+    update(parent);
+    update(node);
+}
+
+void ChildIndex::insertNode(std::uint32_t next, MemoryCell* cell, num gap) {
+    // xorshift, which is plenty random enough to balance the tree
+    seed_ ^= seed_ << 13;
+    seed_ ^= seed_ >> 17;
+    seed_ ^= seed_ << 5;
+    std::uint32_t node;
+    if (freeNodes_.empty()) {
+        node = static_cast<std::uint32_t>(nodes_.size());
+        nodes_.push_back(Node{});
+        updateCharge();
+    } else {
+        node = freeNodes_.back();
+        freeNodes_.pop_back();
+    }
+    nodes_[node] = Node{cell, 0, 0, 0, seed_, gap, 0};
+    cell->slot = node;
+
+    // the new node goes just before next in order, i.e. at the far right of next's left subtree (or
+    // of the whole tree)
+    std::uint32_t parent = next == 0 ? root_ : nodes_[next].left;
+    if (parent == 0 && next != 0) {
+        nodes_[next].left = node;
+        nodes_[node].up = next;
+    } else if (parent == 0) {
+        root_ = node;
+    } else {
+        while (nodes_[parent].right != 0) parent = nodes_[parent].right;
+        nodes_[parent].right = node;
+        nodes_[node].up = parent;
+    }
+    updateUp(node);
+    while (nodes_[node].up != 0 && nodes_[nodes_[node].up].priority < nodes_[node].priority) rotateUp(node);
+}
+
+void ChildIndex::removeNode(std::uint32_t node) {
+    // move the node down until it has at most one child, which can then take its place
+    while (nodes_[node].left != 0 && nodes_[node].right != 0) {
+        std::uint32_t left = nodes_[node].left;
+        std::uint32_t right = nodes_[node].right;
+        rotateUp(nodes_[left].priority > nodes_[right].priority ? left : right);
+    }
+    std::uint32_t child = nodes_[node].left != 0 ? nodes_[node].left : nodes_[node].right;
+    std::uint32_t parent = nodes_[node].up;
+    if (child != 0) nodes_[child].up = parent;
+    if (parent == 0) {
+        root_ = child;
+    } else if (nodes_[parent].left == node) {
+        nodes_[parent].left = child;
+    } else {
+        nodes_[parent].right = child;
+    }
+    updateUp(parent);
+    freeNodes_.push_back(node);
+    updateCharge();
+}
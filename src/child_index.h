@@ -0,0 +1,178 @@
+// child_index.h
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "definitions.h"
+#include "memory_cell.h"
+
+namespace spherehorn {
+
+// An array of a memory cell's children, in the order they appear in their loop, which makes it
+// possible to find the child n places away from another in constant time. Uninstantiated children
+// are null entries.
+//
+// The array is a gap buffer, so that inserting or deleting a child only moves the children between
+// the gap and the point of insertion/deletion. Each child stores its physical index in the array,
+// which is how a child finds its own position. Positions count from an arbitrary point in the loop;
+// first() is the position of the parent's first child, so rotating the loop is just a matter of
+// changing it.
+//
+// Loops with more than MAX_DENSE_SIZE children, and loops with more than MIN_SPARSE_SIZE children
+// in which fewer than 1 in DENSITY have been instantiated, are indexed sparsely instead: only the
+// instantiated children are stored, in a treap ordered by position, and every run of uninstantiated
+// children between them is implicit. Each node records how many uninstantiated children come just
+// before it rather than its position, and the size of its subtree in positions, so a node's position
+// is worked out on the way down (or up) the tree and inserting or deleting a child only changes the
+// nodes on one path. A child's slot is then the number of its node. This keeps memory use
+// proportional to the number of children which have actually been touched, however far apart they
+// are. A sparse index becomes dense once enough of its loop has been instantiated.
+class ChildIndex {
+public:
+    static constexpr std::uint64_t MAX_DENSE_SIZE = 1 << 20;
+    static constexpr std::uint64_t MIN_SPARSE_SIZE = 64;
+    static constexpr std::uint64_t DENSITY = 4;
+    // The most slots a dense index can have, so that every slot number fits in a num and in a
+    // cell's slot. A dense index which fills this up becomes sparse.
+    static constexpr std::size_t MAX_CAPACITY = std::min<std::size_t>(num(-1), TaggedSlot::MAX_SLOT);
+
+private:
+    num size_;
+    bool sparse_;
+    // dense: the gap is the range [gapStart_, gapEnd_) of slots_
+    std::vector<CellLink> slots_;
+    num gapStart_ = 0;
+    num gapEnd_ = 0;
+    // sparse: the treap's nodes, by number. Node 0 stands for a missing node, and always has a span
+    // of 0.
+    struct Node {
+        CellLink cell;
+        std::uint32_t left;
+        std::uint32_t right;
+        std::uint32_t up;
+        // nodes are kept in heap order of this, which is random, so that the tree stays balanced
+        std::uint32_t priority;
+        // the number of uninstantiated children between this one and the one before it (or the start)
+        num gap;
+        // the total of gap + 1 over this node's subtree, i.e. how many positions it covers
+        num span;
+    };
+    std::vector<Node> nodes_;
+    std::vector<std::uint32_t> freeNodes_;
+    std::uint32_t root_ = 0;
+    std::uint32_t seed_ = 0x9e3779b9;
+    num first_ = 0;
+    // the bytes of this index which have been charged to the cell pool
+    std::size_t chargedBytes_ = 0;
+#ifdef SPHEREHORN_COMPACT_CELLS
+    std::uint32_t id_ = 0;
+#endif
+
+public:
+    // Construct an index for a loop of the given size in which nothing is instantiated yet, but
+    // which is about to have numInstantiated children put into it
+    ChildIndex(num size, num numInstantiated);
+    ChildIndex(const ChildIndex&) = delete;
+    ChildIndex& operator =(const ChildIndex&) = delete;
+    ~ChildIndex();
+    constexpr num size() const { return size_; }
+    constexpr bool isSparse() const { return sparse_; }
+    constexpr num first() const { return first_; }
+    void setFirst(num pos) { first_ = pos; }
+    // Return the child at the given position, or null if it hasn't been instantiated
+    MemoryCell* at(num pos) const {
+        if (!sparse_) return slots_[physical(pos)];
+        num nodePos = 0;
+        std::uint32_t node = find(pos, nodePos);
+        return node != 0 && nodePos == pos ? static_cast<MemoryCell*>(nodes_[node].cell) : nullptr;
+    }
+    // Return the position of a child which is in this index
+    num positionOf(const MemoryCell* cell) const {
+        if (sparse_) return sparsePosition(cell->slot);
+        num slot = cell->slot;
+        if (slot < gapStart_) return slot;
+        return slot - (gapEnd_ - gapStart_);
+    }
+    // Call f(pos, child) for every instantiated child, in order of position
+    template <typename Function>
+    void forEach(Function f) const {
+        if (sparse_) {
+            num pos = 0;
+            for (std::uint32_t node = leftmost(root_); node != 0; node = successor(node)) {
+                pos += nodes_[node].gap;
+                f(pos, static_cast<MemoryCell*>(nodes_[node].cell));
+                pos++;
+            }
+            return;
+        }
+        for (num pos = 0; pos < size_; pos++) {
+            MemoryCell* child = slots_[physical(pos)];
+            if (child != nullptr) f(pos, child);
+        }
+    }
+    // Return the position n places forwards/backwards from pos, wrapping around the loop. These
+    // never compute anything bigger than size_, so they can't overflow even with 64-bit nums.
+    constexpr num forward(num pos, num n) const {
+        num step = toNum(n % size_);
+        return step < size_ - pos ? toNum(pos + step) : toNum(pos - (size_ - step));
+    }
+    constexpr num back(num pos, num n) const {
+        num step = toNum(n % size_);
+        return step <= pos ? toNum(pos - step) : toNum(pos + (size_ - step));
+    }
+    // Put an instantiated child into a position, which must be empty or hold a child which is being
+    // replaced
+    void set(num pos, MemoryCell* cell);
+    // Insert a child at the given position, moving the children at and after it one place forwards.
+    // pos may be equal to size(), in which case the child goes after every other child.
+    void insert(num pos, MemoryCell* cell);
+    // Remove the child (which may be uninstantiated) at the given position, moving the children
+    // after it one place backwards. If it was the first child, the caller is responsible for
+    // choosing a new one.
+    void erase(num pos);
+
+#ifdef SPHEREHORN_COMPACT_CELLS
+    // the index's entry in IndexLink::table()
+    constexpr std::uint32_t id() const { return id_; }
+#endif
+
+private:
+    constexpr num physical(num pos) const { return pos < gapStart_ ? pos : pos + (gapEnd_ - gapStart_); }
+    // move the gap so that it starts at the given position
+    void moveGap(num pos);
+    // make the gap bigger, since it's run out of room
+    void grow();
+    // whether a loop of the given size with this many children instantiated should be indexed densely
+    static constexpr bool isDense(std::uint64_t size, std::uint64_t numInstantiated) {
+        return size <= MAX_DENSE_SIZE && (size <= MIN_SPARSE_SIZE || size <= numInstantiated * DENSITY);
+    }
+    // give a dense index an empty array with some room at the end for insertions
+    void allocateSlots();
+    // switch to the sparse/dense representation, keeping every child where it is
+    void makeSparse();
+    void makeDense();
+    // charge the cell pool for however much the index has grown or shrunk since the last time
+    void updateCharge();
+    // store cell in slots_[index], and let it know where it is
+    void place(num index, MemoryCell* cell);
+
+    // For sparse indexes:
+    // Return the first node at or after pos, or 0 if there isn't one, and set nodePos to its position
+    std::uint32_t find(num pos, num& nodePos) const;
+    num sparsePosition(std::uint32_t node) const;
+    std::uint32_t leftmost(std::uint32_t node) const;
+    std::uint32_t successor(std::uint32_t node) const;
+    // Recalculate the span of a node, and then of each of its ancestors
+    void update(std::uint32_t node);
+    void updateUp(std::uint32_t node);
+    // Swap a node with its parent, keeping them in order
+    void rotateUp(std::uint32_t node);
+    // Add a node for cell just before next (or after every other node, if next is 0)
+    void insertNode(std::uint32_t next, MemoryCell* cell, num gap);
+    void removeNode(std::uint32_t node);
+};
+
+}
@@ -0,0 +1,300 @@
+// cpp_emitter.cpp
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "definitions.h"
+#include "program_state.h"
+#include "memory_cell.h"
+#include "memory_image.h"
+#include "arguments.h"
+#include "instruction_container.h"
+#include "instruction_node.h"
+#include "instruction_block.h"
+#include "instructions/set_memory.h"
+#include "bytecode.h"
+#include "cpp_emitter.h"
+using namespace spherehorn;
+using Op = Bytecode::Op;
+using Kind = Arguments::Argument::Kind;
+
+namespace {
+    const std::size_t BYTES_PER_LINE = 16;
+
+    // the name of the class of an instruction which the output hands to its apply()
+    const char* classOf(Op op) {
+        switch (op) {
+        case Op::InputChar: return "InputChar";
+        case Op::InputNum: return "InputNum";
+        case Op::InputString: return "InputString";
+        case Op::OutputChar: return "OutputChar";
+        case Op::OutputNum: return "OutputNum";
+        case Op::OutputString: return "OutputString";
+        case Op::InsertBefore: return "InsertBefore";
+        case Op::InsertAfter: return "InsertAfter";
+        case Op::DeleteBefore: return "DeleteBefore";
+        case Op::DeleteAfter: return "DeleteAfter";
+        default: throw std::logic_error("instruction has no translation");
+        }
+    }
+
+    // the runtime which the output relies on, ahead of main(). Not every program uses all of it.
+    const char* const PRELUDE = R"(
+    MemoryCell* readImage(const unsigned char* image, std::size_t size, MemoryCell*& marked) {
+        std::istringstream in (std::string(reinterpret_cast<const char*>(image), size));
+        return MemoryImage::read(in, marked);
+    }
+    [[maybe_unused]] SharedTree* readLiteral(const unsigned char* image, std::size_t size) {
+        MemoryCell* marked = nullptr;
+        std::unique_ptr<MemoryCell> root (readImage(image, size, marked));
+        return SharedTree::create(std::move(*root));
+    }
+    [[maybe_unused]] int exitCode(Status status) { return status == Status::ABORT ? 1 : 0; }
+}
+)";
+}
+
+void CppEmitter::emit(std::ostream& out, const InstructionBlock& program, const ProgramState& state,
+                      const MemoryCell& memory) {
+    CppEmitter emitter (out);
+    emitter.block(program, program.condition());
+
+    out << "// Compiled from a Spherehorn program by `spherehorn --emit-cpp`. Build it with the\n"
+           "// interpreter's objects, e.g. with `make aot`.\n\n"
+           "#include <cstddef>\n"
+           "#include <memory>\n"
+           "#include <sstream>\n"
+           "#include <string>\n"
+           "#include <utility>\n"
+           "#include \"definitions.h\"\n"
+           "#include \"program_state.h\"\n"
+           "#include \"memory_cell.h\"\n"
+           "#include \"memory_image.h\"\n"
+           "#include \"instruction_container.h\"\n"
+           "#include \"instructions/instructions.h\"\n"
+           "using namespace spherehorn;\n\n"
+           "static_assert(SPHEREHORN_CELL_BITS == " << SPHEREHORN_CELL_BITS << ", \"this program was "
+           "compiled for " << SPHEREHORN_CELL_BITS << "-bit cells\");\n\n"
+           "namespace {\n";
+    emitter.image("memoryImage", memory, state.memoryPtr);
+    for (std::size_t i = 0; i < emitter.literals_.size(); i++) {
+        emitter.image("literalImage" + std::to_string(i), emitter.literals_[i]->root(), nullptr);
+    }
+    out << PRELUDE << "\n"
+           "int main() {\n"
+           "    MemoryCell* memoryPtr = nullptr;\n"
+           "    std::unique_ptr<MemoryCell> memory (readImage(memoryImage, sizeof(memoryImage), memoryPtr));\n";
+    if (!emitter.literals_.empty()) {
+        out << "    SharedTree* literals[] = {\n";
+        for (std::size_t i = 0; i < emitter.literals_.size(); i++) {
+            out << "        readLiteral(literalImage" << i << ", sizeof(literalImage" << i << ")),\n";
+        }
+        out << "    };\n";
+    }
+    out << "    num acc = num{" << std::uint64_t{state.accRegister} << "u};\n"
+           "    bool cond = " << (state.condRegister ? "true" : "false") << ";\n"
+           "    // run an instruction with the interpreter's own implementation of it\n"
+           "    ProgramState state;\n"
+           "    [[maybe_unused]] auto apply = [&acc, &cond, &memoryPtr, &state](auto function, auto... args) {\n"
+           "        state.accRegister = acc;\n"
+           "        state.condRegister = cond;\n"
+           "        state.memoryPtr = memoryPtr;\n"
+           "        Status result = function(state, args...);\n"
+           "        acc = state.accRegister;\n"
+           "        cond = state.condRegister;\n"
+           "        memoryPtr = state.memoryPtr;\n"
+           "        return result;\n"
+           "    };\n\n"
+        << emitter.body_ <<
+           "    return 0;\n"
+           "}\n";
+}
+
+void CppEmitter::block(const InstructionBlock& block, Condition condition) {
+    if (condition != Condition::ALWAYS) {
+        line(condition == Condition::WHEN_TRUE ? "if (cond) {" : "if (!cond) {");
+        depth_++;
+    }
+    line("while (true) {");
+    depth_++;
+    for (const InstructionNode& node : block.nodes()) {
+        if (node.op == Op::Block) {
+            this->block(static_cast<const InstructionBlock&>(*node.instruction), node.condition);
+        } else {
+            instruction(node);
+        }
+    }
+    depth_--;
+    line("}");
+    if (condition != Condition::ALWAYS) {
+        depth_--;
+        line("}");
+    }
+}
+
+void CppEmitter::instruction(const InstructionNode& node) {
+    std::string arg;
+    switch (node.operand) {
+    case Kind::CONSTANT:
+        arg = "num{" + std::to_string(std::uint64_t{node.value}) + "u}";
+        break;
+    case Kind::ACCUMULATOR:
+        arg = "acc";
+        break;
+    case Kind::MEMORY_CELL:
+        arg = "memoryPtr->getVal()";
+        break;
+    }
+    // hand an instruction which would fail to its apply(), which reports the error
+    auto fail = [&arg](const char* name, bool isUnary) {
+        return std::string("return exitCode(apply(Instructions::") + name + "::apply" + (isUnary ? ", " + arg : "") + "));";
+    };
+
+    switch (node.op) {
+    case Op::Break:
+        conditional(node.condition, {"break;"});
+        break;
+    case Op::Increment:
+        conditional(node.condition, {"acc++;"});
+        break;
+    case Op::Decrement:
+        conditional(node.condition, {"if (acc == 0) " + fail("Decrement", false), "acc--;"});
+        break;
+    case Op::Invert:
+        conditional(node.condition, {"cond = !cond;"});
+        break;
+    case Op::MemoryUp:
+        conditional(node.condition, {"memoryPtr = memoryPtr->ascend();", "if (memoryPtr->isTop()) return 0;"});
+        break;
+    case Op::MemoryDown:
+        conditional(node.condition, {"if (memoryPtr->getVal() == 0) " + fail("MemoryDown", false),
+                                     "memoryPtr = memoryPtr->getChild();"});
+        break;
+    case Op::MemoryPrev:
+        conditional(node.condition, {"memoryPtr = memoryPtr->getPrev();"});
+        break;
+    case Op::MemoryNext:
+        conditional(node.condition, {"memoryPtr = memoryPtr->getNext();"});
+        break;
+    case Op::MemoryRestart:
+        conditional(node.condition, {"memoryPtr = memoryPtr->getParent()->getChild();"});
+        break;
+    case Op::MemoryRotate:
+        conditional(node.condition, {"memoryPtr->makeFirst();"});
+        break;
+    case Op::SetAccumulator:
+        conditional(node.condition, {"acc = " + arg + ";"});
+        break;
+    case Op::SetConditional:
+        conditional(node.condition, {"cond = " + arg + " != 0;"});
+        break;
+    case Op::SetMemoryVal:
+        conditional(node.condition, {"memoryPtr->setVal(" + arg + ");"});
+        break;
+    case Op::Add:
+        conditional(node.condition, {"acc += " + arg + ";"});
+        break;
+    case Op::Subtract:
+        conditional(node.condition, {"if (" + arg + " > acc) " + fail("Subtract", true), "acc -= " + arg + ";"});
+        break;
+    case Op::ReverseSubtract:
+        conditional(node.condition, {"if (acc > " + arg + ") " + fail("ReverseSubtract", true), "acc = " + arg + " - acc;"});
+        break;
+    case Op::Multiply:
+        conditional(node.condition, {"acc = toNum(wide_num{acc} * " + arg + ");"});
+        break;
+    case Op::Divide:
+        conditional(node.condition, {"if (" + arg + " == 0) " + fail("Divide", true), "acc /= " + arg + ";"});
+        break;
+    case Op::ReverseDivide:
+        conditional(node.condition, {"if (acc == 0) " + fail("ReverseDivide", true), "acc = " + arg + " / acc;"});
+        break;
+    case Op::Modulo:
+        conditional(node.condition, {"if (" + arg + " == 0) " + fail("Modulo", true), "acc %= " + arg + ";"});
+        break;
+    case Op::ReverseModulo:
+        conditional(node.condition, {"if (acc == 0) " + fail("ReverseModulo", true), "acc = " + arg + " % acc;"});
+        break;
+    case Op::And:
+        conditional(node.condition, {"cond = cond && " + arg + " != 0;"});
+        break;
+    case Op::Or:
+        conditional(node.condition, {"cond = cond || " + arg + " != 0;"});
+        break;
+    case Op::Xor:
+        conditional(node.condition, {"cond = cond != (" + arg + " != 0);"});
+        break;
+    case Op::Greater:
+        conditional(node.condition, {"cond = acc > " + arg + ";"});
+        break;
+    case Op::Equal:
+        conditional(node.condition, {"cond = acc == " + arg + ";"});
+        break;
+    case Op::Less:
+        conditional(node.condition, {"cond = acc < " + arg + ";"});
+        break;
+    case Op::GreaterOrEqual:
+        conditional(node.condition, {"cond = acc >= " + arg + ";"});
+        break;
+    case Op::LessOrEqual:
+        conditional(node.condition, {"cond = acc <= " + arg + ";"});
+        break;
+    case Op::NotEqual:
+        conditional(node.condition, {"cond = acc != " + arg + ";"});
+        break;
+    case Op::MemoryBack:
+        conditional(node.condition, {"memoryPtr = memoryPtr->shiftBack(" + arg + ");"});
+        break;
+    case Op::MemoryForward:
+        conditional(node.condition, {"memoryPtr = memoryPtr->shiftForward(" + arg + ");"});
+        break;
+    case Op::SetMemory:
+        literals_.push_back(&static_cast<const Instructions::SetMemory&>(*node.instruction).value());
+        conditional(node.condition, {"memoryPtr->share(*literals[" + std::to_string(literals_.size() - 1) + "]);"});
+        break;
+
+    // input and output, and inserting and deleting
+    default:
+        conditional(node.condition, {std::string("if (Status result = apply(Instructions::") + classOf(node.op) +
+                                     "::apply); result != Status::OKAY) return exitCode(result);"});
+        break;
+    }
+}
+
+void CppEmitter::line(const std::string& text) {
+    body_.append(depth_ * 4, ' ');
+    body_ += text;
+    body_ += '\n';
+}
+
+void CppEmitter::conditional(Condition condition, const std::vector<std::string>& lines) {
+    if (condition == Condition::ALWAYS) {
+        for (const std::string& text : lines) line(text);
+        return;
+    }
+    std::string test = condition == Condition::WHEN_TRUE ? "if (cond) " : "if (!cond) ";
+    if (lines.size() == 1) {
+        line(test + lines.front());
+        return;
+    }
+    line(test + "{");
+    depth_++;
+    for (const std::string& text : lines) line(text);
+    depth_--;
+    line("}");
+}
+
+void CppEmitter::image(const std::string& name, const MemoryCell& root, const MemoryCell* marked) {
+    std::ostringstream bytes;
+    MemoryImage::write(bytes, root, marked);
+    const std::string& data = bytes.str();
+    out_ << "    const unsigned char " << name << "[] = {";
+    for (std::size_t i = 0; i < data.size(); i++) {
+        out_ << (i % BYTES_PER_LINE == 0 ? "\n        " : " ") << unsigned{static_cast<unsigned char>(data[i])} << ",";
+    }
+    out_ << "\n    };\n";
+}
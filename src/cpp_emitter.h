@@ -0,0 +1,53 @@
+// cpp_emitter.h
+
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "definitions.h"
+#include "program_state.h"
+#include "memory_cell.h"
+#include "instruction_node.h"
+#include "instruction_block.h"
+
+namespace spherehorn {
+
+// Translates a parsed program into a standalone C++ program, which does the same thing when it's
+// compiled and linked with the interpreter's own objects (see `make aot` in the makefile).
+//
+// Each block becomes a `while (true)` loop, and a break becomes a C++ break. The instructions become
+// straight-line code on local variables, like the cases of Bytecode::run(). The ones it doesn't do
+// itself, and the error paths of those it does, call the instruction classes' static apply(). The
+// initial memory and every memory literal become static MemoryImages, which are read in when the
+// program starts.
+//
+// The compiled program takes no options: it runs as the interpreter does by default, without
+// checkpoints, a limit on memory cells, deferred freeing or compaction.
+class CppEmitter {
+private:
+    std::ostream& out_;
+    std::size_t depth_ = 1;
+    // the trees of the memory literals, in the order they're numbered in the output
+    std::vector<const SharedTree*> literals_;
+    std::string body_;
+
+public:
+    // Write the program whose top-level block is program, starting with the given registers and
+    // memory (with the memory pointer at state.memoryPtr)
+    static void emit(std::ostream& out, const InstructionBlock& program, const ProgramState& state,
+                     const MemoryCell& memory);
+
+private:
+    CppEmitter(std::ostream& out) : out_(out) {}
+    void block(const InstructionBlock& block, Condition condition);
+    void instruction(const InstructionNode& node);
+    // Add a line (or, if it's conditional, an if statement) to the body of main()
+    void line(const std::string& text);
+    void conditional(Condition condition, const std::vector<std::string>& lines);
+    // Write a MemoryImage of the tree as an array of bytes
+    void image(const std::string& name, const MemoryCell& root, const MemoryCell* marked);
+};
+
+}
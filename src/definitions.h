@@ -2,4 +2,33 @@
 
 #pragma once
 
+#include <cstdint>
+#include <type_traits>
+
+// The width of a memory cell's value and of the accumulator, in bits: 8, 16, 32 or 64. It's fixed at
+// compile time (see CELL_BITS in the makefile), so narrow builds get smaller memory cells and wide
+// builds get 64-bit arithmetic without paying for the choice at runtime.
+#ifndef SPHEREHORN_CELL_BITS
+#define SPHEREHORN_CELL_BITS 32
+#endif
+
+#if SPHEREHORN_CELL_BITS == 8
+typedef std::uint8_t num;
+#elif SPHEREHORN_CELL_BITS == 16
+typedef std::uint16_t num;
+#elif SPHEREHORN_CELL_BITS == 32
 typedef unsigned int num;
+#elif SPHEREHORN_CELL_BITS == 64
+typedef std::uint64_t num;
+#else
+#error "SPHEREHORN_CELL_BITS must be 8, 16, 32 or 64"
+#endif
+
+// An unsigned type which can hold any num. Arithmetic on types narrower than int promotes them to
+// (signed) int, so narrow nums are widened to this where that could overflow. iostreams also treat
+// it as a number, whereas they'd treat the 8-bit num as a character.
+typedef std::common_type_t<num, unsigned int> wide_num;
+
+// Convert a value, e.g. the result of arithmetic on nums, back to a num
+template <typename T>
+constexpr num toNum(T value) { return static_cast<num>(value); }
@@ -1,14 +1,93 @@
 // instruction.h
 
+#include <iostream>
+#include <stdexcept>
 #include "program_state.h"
+#include "memory_cell.h"
+#include "checkpoint.h"
+#include "bytecode.h"
+#include "instruction_node.h"
 #include "instruction_block.h"
 using namespace spherehorn;
 
+InstructionNode InstructionBlock::node() {
+    return InstructionNode::wrap(Bytecode::Op::Block, condition_, *this);
+}
+
 Status InstructionBlock::action(ProgramState& state) {
+    if (nodes_.empty()) throw std::out_of_range("instruction block has no instructions");
+    unsigned int i = 0;
+    // if the program is resuming from a checkpoint, pick up where it left off
+    bool isResumingChild = false;
+    if (state.isResuming()) {
+        i = state.position[state.resumeDepth++];
+        // unless this is the innermost block, nodes_[i] is a block which was already running, so we
+        // go straight back into it rather than checking its condition again
+        isResumingChild = state.isResuming();
+        if (!isResumingChild) {
+            state.position.clear();
+            state.resumeDepth = 0;
+        }
+    }
+
     Status result = Status::OKAY;
-    for (unsigned int i = 0; result == Status::OKAY; i = (i + 1) % instrs.size()) {
-        result = instrs.at(i)->run(state);
+    while (true) {
+        if (isResumingChild) {
+            result = static_cast<InstructionBlock&>(*nodes_[i].instruction).action(state);
+            isResumingChild = false;
+        } else {
+            const InstructionNode& node = nodes_[i];
+            result = node.run(node, state);
+        }
+        state.memoryPtr = tidyMemory(state.memoryPtr);
+        if (result == Status::OKAY && isOverLimit()) return Status::ABORT;
+        // a block inside this one has suspended, so record where we are in this one too
+        if (result == Status::SUSPEND) {
+            state.position.push_back(i);
+            return result;
+        }
+        if (result != Status::OKAY) break;
+
+        if (++i == nodes_.size()) i = 0;
+        if (--state.untilCheckpoint == 0 || Checkpoint::isRequested) {
+            state.position.push_back(i);
+            return Status::SUSPEND;
+        }
     }
     return result == Status::BREAK ? Status::OKAY : result;
 }
 
+void InstructionBlock::compile(Bytecode& code) {
+    code.beginBlock(condition_);
+    for (const InstructionNode& node : nodes_) {
+        if (node.op == Bytecode::Op::Block) {
+            static_cast<InstructionBlock*>(node.instruction)->compile(code);
+        } else {
+            code.emit(node);
+        }
+    }
+    code.endBlock();
+}
+
+MemoryCell* InstructionBlock::compactMemory(MemoryCell* memoryPtr) {
+    MemoryCell* root = memoryPtr;
+    while (!root->isTop()) root = root->getParent();
+    MemoryCell::compact(*root, memoryPtr);
+    return memoryPtr;
+}
+
+bool InstructionBlock::isOverLimit() {
+    if (!MemoryCell::pool().isOverLimit()) return false;
+    const CellPool& pool = MemoryCell::pool();
+    std::cerr << "Error: Exceeded the memory limit of " << pool.limitBytes() << " bytes (" << pool.limit()
+              << " memory cells' worth)" << std::endl;
+    return true;
+}
+
+bool InstructionBlock::isValidPosition(const std::vector<unsigned int>& position, std::size_t depth) const {
+    if (depth >= position.size() || position[depth] >= nodes_.size()) return false;
+    if (depth + 1 == position.size()) return true;
+    const InstructionNode& node = nodes_[position[depth]];
+    return node.op == Bytecode::Op::Block &&
+           static_cast<const InstructionBlock*>(node.instruction)->isValidPosition(position, depth + 1);
+}
@@ -15,21 +15,51 @@ See instruction_container.h for a more complete view of the tree.
 #include <memory>
 #include <utility>
 #include "program_state.h"
+#include "memory_cell.h"
 #include "instruction_container.h"
+#include "instruction_node.h"
+#include "bytecode.h"
 
 namespace spherehorn {
 
 class InstructionBlock : public InstructionContainer {
 private:
-    std::vector<instr_ptr> instrs;
+    // the block's instructions, in order
+    std::vector<InstructionNode> nodes_;
+    // the instructions which are wrapped by nodes (see instruction_node.h); the rest aren't needed
+    // once they've been made into nodes
+    std::vector<instr_ptr> wrapped_;
 public:
     InstructionBlock(Condition condition = Condition::ALWAYS) : InstructionContainer(condition) {}
     ~InstructionBlock() {}
     void insertInstr(instr_ptr& instr) {
-        instrs.push_back(std::move(instr));
+        nodes_.push_back(instr->node());
+        if (nodes_.back().instruction != nullptr) {
+            wrapped_.push_back(std::move(instr));
+        } else {
+            instr.reset();
+        }
     }
-    // execute each instruction in instrs in a loop until we break out
+    InstructionNode node();
+    const std::vector<InstructionNode>& nodes() const { return nodes_; }
+    // execute each instruction in nodes_ in a loop until we break out
     Status action(ProgramState& state);
+    // Lower this block and everything in it into code
+    void compile(Bytecode& code);
+    // Return whether position[depth] onwards is the position of an instruction within this block
+    bool isValidPosition(const std::vector<unsigned int>& position, std::size_t depth = 0) const;
+    // The upkeep which is done between instructions: destroy a little of any tree which is waiting
+    // to be reclaimed, and gather the memory tree back up if it's been scattered. Returns where the
+    // memory pointer's cell is now.
+    static MemoryCell* tidyMemory(MemoryCell* memoryPtr) {
+        if (MemoryCell::hasGarbage()) [[unlikely]] MemoryCell::reclaimSome();
+        if (MemoryCell::needsCompaction()) [[unlikely]] return compactMemory(memoryPtr);
+        return memoryPtr;
+    }
+    // Compact the memory tree that memoryPtr is in, returning where its cell is now
+    static MemoryCell* compactMemory(MemoryCell* memoryPtr);
+    // Return whether the program has gone over its limit on memory cells, printing an error if so
+    static bool isOverLimit();
 };
 
 }
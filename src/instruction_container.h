@@ -14,21 +14,27 @@ SetMemory) and UnaryInstruction (for unary instructions).
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include "program_state.h"
 
 namespace spherehorn {
 
+struct InstructionNode;
+
 // The value returned by a call to .run(), indicating whether to continue execution as normal, break
 // out of the current loop, exit the program gracefully, or abort termination with an error message.
+// SUSPEND means that the program is stopping so that a checkpoint can be taken, and will be resumed
+// from ProgramState::position.
 enum struct Status {
     OKAY,
     BREAK,
     EXIT,
     ABORT,
+    SUSPEND,
 };
 
-enum struct Condition {
+enum struct Condition : std::uint8_t {
     ALWAYS,
     WHEN_TRUE,
     WHEN_FALSE,
@@ -42,6 +48,9 @@ protected:
 public:
     InstructionContainer(Condition condition) : condition_(condition) {}
     virtual ~InstructionContainer() {}
+    Condition condition() const { return condition_; }
+    // Return the node that a block keeps for this instruction (see instruction_node.h)
+    virtual InstructionNode node() = 0;
     // Run the overloaded .action() method, or simply do nothing if we shouldn't execute because of
     // a conditional.
     Status run(ProgramState& state) {
@@ -0,0 +1,104 @@
+// instruction_node.h
+
+#pragma once
+
+#include "definitions.h"
+#include "program_state.h"
+#include "arguments.h"
+#include "instruction_container.h"
+#include "bytecode.h"
+
+namespace spherehorn {
+
+// An instruction as a block stores it. Blocks keep their instructions' nodes by value, next to each
+// other, and run each one by calling its function directly.
+//
+// Each nullary and unary instruction class makes its node with nullary() or unary(), which pick a
+// function specialized on the instruction, the kind of its argument and its condition. That
+// function has the argument and the condition test compiled into it (or left out, if the
+// instruction always runs), and it calls the instruction's static apply() with no virtual calls
+// at all; the instruction object itself isn't needed once its node has been made. Blocks and memory
+// setters, which own more than fits in a node, are wrapped instead, and keep their objects.
+struct InstructionNode {
+    using Function = Status (*)(const InstructionNode& node, ProgramState& state);
+    using Kind = Arguments::Argument::Kind;
+
+    Function run;
+    // the argument, if it's a constant
+    num value;
+    // which instruction this is, which the bytecode is lowered from
+    Bytecode::Op op;
+    Kind operand;
+    Condition condition;
+    // the instruction this wraps, if it was wrapped
+    InstructionContainer* instruction;
+
+    template <typename Instruction>
+    static InstructionNode nullary(Bytecode::Op op, Condition condition) {
+        return {functionFor<NullaryFunction<Instruction>>(condition), 0, op, Kind::CONSTANT, condition, nullptr};
+    }
+    template <typename Instruction>
+    static InstructionNode unary(Bytecode::Op op, Condition condition, Arguments::Argument& arg) {
+        InstructionNode node {nullptr, 0, op, arg.kind(), condition, nullptr};
+        switch (node.operand) {
+        case Kind::CONSTANT:
+            // constants don't need the program's state to get their values
+            node.value = arg.get();
+            node.run = functionFor<UnaryFunction<Instruction, Kind::CONSTANT>>(condition);
+            break;
+        case Kind::ACCUMULATOR:
+            node.run = functionFor<UnaryFunction<Instruction, Kind::ACCUMULATOR>>(condition);
+            break;
+        case Kind::MEMORY_CELL:
+            node.run = functionFor<UnaryFunction<Instruction, Kind::MEMORY_CELL>>(condition);
+            break;
+        }
+        return node;
+    }
+    static InstructionNode wrap(Bytecode::Op op, Condition condition, InstructionContainer& instruction) {
+        return {runWrapped, 0, op, Kind::CONSTANT, condition, &instruction};
+    }
+
+private:
+    template <Condition CONDITION>
+    static bool isSkipped(const ProgramState& state) {
+        if constexpr (CONDITION == Condition::WHEN_TRUE) return !state.condRegister;
+        if constexpr (CONDITION == Condition::WHEN_FALSE) return state.condRegister;
+        return false;
+    }
+    template <typename Instruction>
+    struct NullaryFunction {
+        template <Condition CONDITION>
+        static Status run(const InstructionNode&, ProgramState& state) {
+            if (isSkipped<CONDITION>(state)) return Status::OKAY;
+            return Instruction::apply(state);
+        }
+    };
+    template <typename Instruction, Kind KIND>
+    struct UnaryFunction {
+        template <Condition CONDITION>
+        static Status run(const InstructionNode& node, ProgramState& state) {
+            if (isSkipped<CONDITION>(state)) return Status::OKAY;
+            if constexpr (KIND == Kind::CONSTANT) return Instruction::apply(state, node.value);
+            if constexpr (KIND == Kind::ACCUMULATOR) return Instruction::apply(state, state.accRegister);
+            return Instruction::apply(state, state.memoryPtr->getVal());
+        }
+    };
+    // Return the specialization of Functions::run for a condition which is only known at runtime
+    template <typename Functions>
+    static Function functionFor(Condition condition) {
+        switch (condition) {
+        case Condition::WHEN_TRUE:
+            return Functions::template run<Condition::WHEN_TRUE>;
+        case Condition::WHEN_FALSE:
+            return Functions::template run<Condition::WHEN_FALSE>;
+        default:
+            return Functions::template run<Condition::ALWAYS>;
+        }
+    }
+    static Status runWrapped(const InstructionNode& node, ProgramState& state) {
+        return node.instruction->run(state);
+    }
+};
+
+}
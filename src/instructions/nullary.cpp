@@ -2,15 +2,18 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
 #include <climits>
 #include "../program_state.h"
 #include "../memory_cell.h"
+#include "../bytecode.h"
+#include "../instruction_node.h"
 #include "nullary.h"
 
 using namespace spherehorn;
 using std::string;
 // lazy way to shorten repetitive function implementations
-#define impl(A) Status Instructions::A::action([[maybe_unused]] ProgramState& state)
+#define impl(A) Status Instructions::A::apply([[maybe_unused]] ProgramState& state)
 
 impl(Break) {
     return Status::BREAK;
@@ -45,47 +48,62 @@ impl(InputChar) {
 }
 
 impl(InputNum) {
-    num inNum = 0;
+    // read it as wide as possible, so that numbers too big for a num can be told apart (a number
+    // too big even for this reads as the biggest one, and makes the read fail)
+    unsigned long long inNum = 0;
     std::cin >> inNum;
-    state.memoryPtr->setVal(inNum);
+    if (inNum > num(-1) || (inNum == ULLONG_MAX && std::cin.fail())) {
+        std::cerr << "Error: Attempted numin of a number larger than " << wide_num{num(-1)} << std::endl;
+        return Status::ABORT;
+    }
+    state.memoryPtr->setVal(toNum(inNum));
     return Status::OKAY;
 }
 
 impl(InputString) {
     string inString;
     std::getline(std::cin, inString);
-    state.memoryPtr->setVal(inString.length());
-
-    MemoryCell* currChild = state.memoryPtr->getChild();
-    for (auto it = inString.begin(); it != inString.end(); ++it) {
-        currChild->setVal(static_cast<num>(*it));
-        currChild = currChild->getNext();
+    if (inString.length() > num(-1)) {
+        std::cerr << "Error: Attempted strin of a string longer than " << wide_num{num(-1)} << " characters" << std::endl;
+        return Status::ABORT;
     }
+    // the characters are all leaves, so they can go straight into a PACKED array
+    std::vector<num> values;
+    values.reserve(inString.length());
+    for (char c : inString) values.push_back(static_cast<num>(c));
+    state.memoryPtr->setLeaves(std::move(values));
     return Status::OKAY;
 }
 
 impl(OutputChar) {
-    num outNum = state.memoryPtr->getVal();
+    wide_num outNum = state.memoryPtr->getVal();
     // the given character needs to be ASCII
     if (outNum > UCHAR_MAX) {
         std::cerr << "Error: Attempted chout of invalid character ( #" << outNum << " )" << std::endl;
         return Status::ABORT;
     }
-    std::cout << (unsigned char) outNum;
+    std::cout.put(static_cast<char>(outNum));
     return Status::OKAY;
 }
 
 impl(OutputNum) {
     num outNum = state.memoryPtr->getVal();
-    std::cout << outNum;
+    std::cout << wide_num{outNum};
     return Status::OKAY;
 }
 
 impl(OutputString) {
+    // if the string is PACKED, we can write it all at once without instantiating any cells
+    if (const std::vector<num>* leaves = state.memoryPtr->getLeaves()) {
+        string outString (leaves->size(), '\0');
+        for (std::size_t i = 0; i < leaves->size(); i++) outString[i] = static_cast<char>((*leaves)[i]);
+        std::cout.write(outString.data(), static_cast<std::streamsize>(outString.size()));
+        return Status::OKAY;
+    }
     MemoryCell* currChild = state.memoryPtr->getChild();
     num stringLength = state.memoryPtr->getVal();
     for (num i = 0; i < stringLength; i++) {
-        std::cout << (unsigned char) currChild->getVal();
+        std::cout.put(static_cast<char>(currChild->getVal()));
         currChild = currChild->getNext();
     }
     return Status::OKAY;
@@ -93,7 +111,7 @@ impl(OutputString) {
 
 
 impl(MemoryUp) {
-    MemoryCell* parent = state.memoryPtr->getParent();
+    MemoryCell* parent = state.memoryPtr->ascend();
     state.memoryPtr = parent;
     // if we've exited the memory tree, the program should exit
     if (parent->isTop()) {
@@ -133,11 +151,19 @@ impl(MemoryRotate) {
 }
 
 impl(InsertBefore) {
+    if (state.memoryPtr->getParent()->getVal() == num(-1)) {
+        std::cerr << "Error: Attempted to insert into a loop of the largest possible size" << std::endl;
+        return Status::ABORT;
+    }
     state.memoryPtr = state.memoryPtr->insertBefore();
     return Status::OKAY;
 }
 
 impl(InsertAfter) {
+    if (state.memoryPtr->getParent()->getVal() == num(-1)) {
+        std::cerr << "Error: Attempted to insert into a loop of the largest possible size" << std::endl;
+        return Status::ABORT;
+    }
     state.memoryPtr = state.memoryPtr->insertAfter();
     return Status::OKAY;
 }
@@ -165,3 +191,30 @@ impl(DeleteAfter) {
 }
 
 #undef impl
+
+// each instruction's node calls its apply() directly, without going through the object
+#define lower(A) \
+    InstructionNode Instructions::A::node() { return InstructionNode::nullary<A>(Bytecode::Op::A, condition_); }
+
+lower(Break)
+lower(Increment)
+lower(Decrement)
+lower(Invert)
+lower(InputChar)
+lower(InputNum)
+lower(InputString)
+lower(OutputChar)
+lower(OutputNum)
+lower(OutputString)
+lower(MemoryUp)
+lower(MemoryDown)
+lower(MemoryPrev)
+lower(MemoryNext)
+lower(MemoryRestart)
+lower(MemoryRotate)
+lower(InsertBefore)
+lower(InsertAfter)
+lower(DeleteBefore)
+lower(DeleteAfter)
+
+#undef lower
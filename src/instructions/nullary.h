@@ -12,8 +12,10 @@
     public: \
         A(Condition condition) : InstructionContainer(condition) {} \
         ~A() {} \
+        InstructionNode node(); \
+        static Status apply(ProgramState& state); \
     protected: \
-        Status action(ProgramState& state); \
+        Status action(ProgramState& state) { return apply(state); } \
     }
 
 namespace spherehorn {
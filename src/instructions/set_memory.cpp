@@ -2,11 +2,18 @@
 
 #include "../program_state.h"
 #include "../memory_cell.h"
+#include "../bytecode.h"
+#include "../instruction_node.h"
 #include "set_memory.h"
 using namespace spherehorn;
 
+InstructionNode Instructions::SetMemory::node() {
+    // the literal's tree doesn't fit in a node, so the node keeps this instruction
+    return InstructionNode::wrap(Bytecode::Op::SetMemory, condition_, *this);
+}
+
 Status Instructions::SetMemory::action(ProgramState& state) {
-    *state.memoryPtr = value_; // copy assignment
+    state.memoryPtr->share(*value_);
     return Status::OKAY;
 }
 
@@ -12,15 +12,22 @@ namespace spherehorn {
 namespace Instructions {
     class SetMemory : public InstructionContainer {
     private:
-        MemoryCell value_;
+        // every cell the literal is assigned to shares its children until they're modified
+        SharedTree* value_;
     public:
         SetMemory(Condition condition, MemoryCell& value) :
-            InstructionContainer(condition),
-            value_(value) {}
+            SetMemory(condition, MemoryCell{value}) {}
         SetMemory(Condition condition, MemoryCell&& value) :
+            SetMemory(condition, SharedTree::create(std::move(value))) {}
+        // Take over a reference to a tree, e.g. one from a LiteralPool
+        SetMemory(Condition condition, SharedTree* value) :
             InstructionContainer(condition),
-            value_(std::move(value)) {}
-        ~SetMemory() {}
+            value_(value) {}
+        SetMemory(const SetMemory&) = delete;
+        SetMemory& operator =(const SetMemory&) = delete;
+        ~SetMemory() { value_->release(); }
+        const SharedTree& value() const { return *value_; }
+        InstructionNode node();
     protected:
         Status action(ProgramState& state);
     };
@@ -4,68 +4,71 @@
 #include "../definitions.h"
 #include "../program_state.h"
 #include "../arguments.h"
+#include "../bytecode.h"
+#include "../instruction_node.h"
 #include "unary.h"
 
 using namespace spherehorn;
 // lazy way to shorten repetitive function implementations
-#define impl(A) Status Instructions::A::action([[maybe_unused]] ProgramState& state)
+#define impl(A) Status Instructions::A::apply([[maybe_unused]] ProgramState& state, [[maybe_unused]] num value)
 
 impl(SetAccumulator) {
-    state.accRegister = arg->get();
+    state.accRegister = value;
     return Status::OKAY;
 }
 
 impl(SetConditional) {
-    state.condRegister = arg->get();
+    state.condRegister = value;
     return Status::OKAY;
 }
 
 impl(SetMemoryVal) {
-    state.memoryPtr->setVal(arg->get());
+    state.memoryPtr->setVal(value);
     return Status::OKAY;
 }
 
 
 impl(Add) {
-    state.accRegister += arg->get();
+    state.accRegister += value;
     return Status::OKAY;
 }
 
 impl(Subtract) {
     // abort if we would underflow
-    if (arg->get() > state.accRegister) {
+    if (value > state.accRegister) {
         std::cerr << "Error: Attempted to perform invalid SUB "
-                     "( " << state.accRegister << " - " << arg->get() << " )" << std::endl;
+                     "( " << wide_num{state.accRegister} << " - " << wide_num{value} << " )" << std::endl;
         return Status::ABORT;
     }
-    state.accRegister -= arg->get();
+    state.accRegister -= value;
     return Status::OKAY;
 }
 
 impl(ReverseSubtract) {
     // abort if we would underflow
-    if (state.accRegister > arg->get()) {
+    if (state.accRegister > value) {
         std::cerr << "Error: Attempted to perform invalid RSUB "
-                     "( " << arg->get() << " - " << state.accRegister << " )" << std::endl;
+                     "( " << wide_num{value} << " - " << wide_num{state.accRegister} << " )" << std::endl;
         return Status::ABORT;
     }
-    state.accRegister = arg->get() - state.accRegister;
+    state.accRegister = value - state.accRegister;
     return Status::OKAY;
 }
 
 impl(Multiply) {
-    state.accRegister *= arg->get();
+    // narrow nums would be multiplied as signed ints, which could overflow
+    state.accRegister = toNum(wide_num{state.accRegister} * value);
     return Status::OKAY;
 }
 
 impl(Divide) {
     // abort if we would divide by zero
-    if (arg->get() == 0) {
+    if (value == 0) {
         std::cerr << "Error: Attempted to perform DIV by zero "
-                     "( " << state.accRegister << " / " << arg->get() << " )" << std::endl;
+                     "( " << wide_num{state.accRegister} << " / " << wide_num{value} << " )" << std::endl;
         return Status::ABORT;
     }
-    state.accRegister /= arg->get();
+    state.accRegister /= value;
     return Status::OKAY;
 }
 
@@ -73,21 +76,21 @@ impl(ReverseDivide) {
     // abort if we would divide by zero
     if (state.accRegister == 0) {
         std::cerr << "Error: Attempted to perform RDIV by zero "
-                     "( " << arg->get() << " / " << " )" << std::endl;
+                     "( " << wide_num{value} << " / " << " )" << std::endl;
         return Status::ABORT;
     }
-    state.accRegister = arg->get() / state.accRegister;
+    state.accRegister = value / state.accRegister;
     return Status::OKAY;
 }
 
 impl(Modulo) {
     // abort if we would mod by zero
-    if (arg->get() == 0) {
+    if (value == 0) {
         std::cerr << "Error: Attempted to perform MOD by zero "
-                     "( " << state.accRegister << " % " << arg->get() << " )" << std::endl;
+                     "( " << wide_num{state.accRegister} << " % " << wide_num{value} << " )" << std::endl;
         return Status::ABORT;
     }
-    state.accRegister %= arg->get();
+    state.accRegister %= value;
     return Status::OKAY;
 }
 
@@ -95,69 +98,99 @@ impl(ReverseModulo) {
     // abort if we would mod by zero
     if (state.accRegister == 0) {
         std::cerr << "Error: Attempted to perform RMOD by zero "
-                     "( " << arg->get() << " % " << state.accRegister << " )" << std::endl;
+                     "( " << wide_num{value} << " % " << wide_num{state.accRegister} << " )" << std::endl;
         return Status::ABORT;
     }
-    state.accRegister = arg->get() % state.accRegister;
+    state.accRegister = value % state.accRegister;
     return Status::OKAY;
 }
 
 
 impl(And) {
-    state.condRegister = state.condRegister && arg->get();
+    state.condRegister = state.condRegister && value;
     return Status::OKAY;
 }
 
 impl(Or) {
-    state.condRegister = state.condRegister || arg->get();
+    state.condRegister = state.condRegister || value;
     return Status::OKAY;
 }
 
 impl(Xor) {
-    state.condRegister = state.condRegister != !!arg->get();
+    state.condRegister = state.condRegister != !!value;
     return Status::OKAY;
 }
 
 
 impl(Greater) {
-    state.condRegister = state.accRegister > arg->get();
+    state.condRegister = state.accRegister > value;
     return Status::OKAY;
 }
 
 impl(Equal) {
-    state.condRegister = state.accRegister == arg->get();
+    state.condRegister = state.accRegister == value;
     return Status::OKAY;
 }
 
 impl(Less) {
-    state.condRegister = state.accRegister < arg->get();
+    state.condRegister = state.accRegister < value;
     return Status::OKAY;
 }
 
 impl(GreaterOrEqual) {
-    state.condRegister = state.accRegister >= arg->get();
+    state.condRegister = state.accRegister >= value;
     return Status::OKAY;
 }
 
 impl(LessOrEqual) {
-    state.condRegister = state.accRegister <= arg->get();
+    state.condRegister = state.accRegister <= value;
     return Status::OKAY;
 }
 
 impl(NotEqual) {
-    state.condRegister = state.accRegister != arg->get();
+    state.condRegister = state.accRegister != value;
     return Status::OKAY;
 }
 
 
 impl(MemoryBack) {
-    state.memoryPtr = state.memoryPtr->shiftBack(arg->get());
+    state.memoryPtr = state.memoryPtr->shiftBack(value);
     return Status::OKAY;
 }
 
 impl(MemoryForward) {
-    state.memoryPtr = state.memoryPtr->shiftForward(arg->get());
+    state.memoryPtr = state.memoryPtr->shiftForward(value);
     return Status::OKAY;
 }
 
 #undef impl
+
+// each instruction's node calls its apply() directly, without going through the object or its
+// argument
+#define lower(A) \
+    InstructionNode Instructions::A::node() { return InstructionNode::unary<A>(Bytecode::Op::A, condition_, *arg); }
+
+lower(SetAccumulator)
+lower(SetConditional)
+lower(SetMemoryVal)
+lower(Add)
+lower(Subtract)
+lower(ReverseSubtract)
+lower(Multiply)
+lower(Divide)
+lower(ReverseDivide)
+lower(Modulo)
+lower(ReverseModulo)
+lower(And)
+lower(Or)
+lower(Xor)
+lower(Greater)
+lower(Equal)
+lower(Less)
+lower(GreaterOrEqual)
+lower(LessOrEqual)
+lower(NotEqual)
+lower(MemoryBack)
+lower(MemoryForward)
+
+#undef lower
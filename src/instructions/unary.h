@@ -15,8 +15,10 @@
         A(Condition condition, arg_ptr& _arg) : UnaryInstruction(condition, _arg) {} \
         A(Condition condition, arg_ptr&& _arg) : UnaryInstruction(condition, _arg) {} \
         ~A() {} \
+        InstructionNode node(); \
+        static Status apply(ProgramState& state, num value); \
     protected: \
-        Status action(ProgramState& state); \
+        Status action(ProgramState& state) { return apply(state, arg->get()); } \
     }
 
 namespace spherehorn {
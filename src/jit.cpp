@@ -0,0 +1,644 @@
+// jit.cpp
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "definitions.h"
+#include "program_state.h"
+#include "memory_cell.h"
+#include "cell_pool.h"
+#include "arguments.h"
+#include "checkpoint.h"
+#include "instruction_container.h"
+#include "instruction_block.h"
+#include "instruction_node.h"
+#include "bytecode.h"
+#include "jit.h"
+using namespace spherehorn;
+using Op = Bytecode::Op;
+using Kind = Arguments::Argument::Kind;
+
+namespace {
+    // The registers while native code isn't running. The native code is passed a pointer to this,
+    // which it keeps in R14, and it writes its registers back here before calling anything that
+    // uses the program's state.
+    struct Context {
+        std::uint64_t acc;
+        std::uint64_t cond;
+        MemoryCell* memoryPtr;
+        std::uint64_t untilCheckpoint;
+        ProgramState* state;
+        // the instruction to resume from, if the program suspended
+        std::uint32_t pc;
+    };
+    using Entry = Status (*)(Context* context, const void* start);
+
+    // The functions which native code calls. They're plain functions, so that the native code can
+    // call them with the usual calling convention.
+    Status runNode(Context* context, const InstructionNode* node) {
+        ProgramState& state = *context->state;
+        state.accRegister = toNum(context->acc);
+        state.condRegister = context->cond != 0;
+        state.memoryPtr = context->memoryPtr;
+        state.untilCheckpoint = context->untilCheckpoint;
+        Status result = node->run(*node, state);
+        context->acc = state.accRegister;
+        context->cond = state.condRegister;
+        context->memoryPtr = state.memoryPtr;
+        context->untilCheckpoint = state.untilCheckpoint;
+        return result;
+    }
+    bool tidyMemory(Context* context) {
+        context->memoryPtr = InstructionBlock::tidyMemory(context->memoryPtr);
+        return MemoryCell::pool().isOverLimit() && InstructionBlock::isOverLimit();
+    }
+    num getVal(MemoryCell* cell) { return cell->getVal(); }
+    void setVal(MemoryCell* cell, num value) { cell->setVal(value); }
+    MemoryCell* ascend(MemoryCell* cell) { return cell->ascend(); }
+    bool isTop(MemoryCell* cell) { return cell->isTop(); }
+    // null if there's nothing to descend into, so that the node can report the error
+    MemoryCell* descend(MemoryCell* cell) { return cell->getVal() == 0 ? nullptr : cell->getChild(); }
+    MemoryCell* getPrev(MemoryCell* cell) { return cell->getPrev(); }
+    MemoryCell* getNext(MemoryCell* cell) { return cell->getNext(); }
+    MemoryCell* restart(MemoryCell* cell) { return cell->getParent()->getChild(); }
+    void makeFirst(MemoryCell* cell) { cell->makeFirst(); }
+    MemoryCell* shiftBack(MemoryCell* cell, num n) { return cell->shiftBack(n); }
+    MemoryCell* shiftForward(MemoryCell* cell, num n) { return cell->shiftForward(n); }
+
+    // the registers, by their numbers in instruction encodings
+    enum Register : std::uint8_t {
+        RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+        R12 = 12, R13 = 13, R14 = 14, R15 = 15,
+    };
+    // what each register holds while the native code runs
+    const Register ACC = RBX;
+    const Register COND = R12;
+    const Register MEMORY_PTR = R13;
+    const Register CONTEXT = R14;
+    const Register UNTIL_CHECKPOINT = R15;
+    // the address of Checkpoint::isRequested
+    const Register IS_REQUESTED = RBP;
+    // where arguments are loaded to
+    const Register OPERAND = RAX;
+
+    // condition codes, for jumps and setcc
+    enum ConditionCode : std::uint8_t {
+        BELOW = 0x2, ABOVE_OR_EQUAL = 0x3, EQUAL = 0x4, NOT_EQUAL = 0x5, BELOW_OR_EQUAL = 0x6, ABOVE = 0x7,
+    };
+
+    // whether the accumulator and arguments are 64 bits, rather than 32
+    constexpr bool WIDE = sizeof(num) == 8;
+
+    // Encodes the few x86-64 instructions that the translation needs. Jumps go to labels, which
+    // are numbered, and are filled in once everything has been emitted.
+    class Assembler {
+    private:
+        std::vector<std::uint8_t> bytes_;
+        // where each label is, or -1 if it hasn't been placed yet
+        std::vector<std::int64_t> labels_;
+        // the offsets of jumps, with the labels they go to
+        std::vector<std::pair<std::size_t, std::size_t>> jumps_;
+
+    public:
+        const std::vector<std::uint8_t>& bytes() const { return bytes_; }
+        std::size_t size() const { return bytes_.size(); }
+
+        std::size_t newLabel() {
+            labels_.push_back(-1);
+            return labels_.size() - 1;
+        }
+        void place(std::size_t label) { labels_[label] = static_cast<std::int64_t>(bytes_.size()); }
+        // Fill in every jump's offset. Throws std::logic_error if a label was never placed.
+        void link() {
+            for (auto [at, label] : jumps_) {
+                if (labels_[label] < 0) throw std::logic_error("native code jumps to a label which was never placed");
+                std::int64_t offset = labels_[label] - static_cast<std::int64_t>(at + 4);
+                std::int32_t offset32 = static_cast<std::int32_t>(offset);
+                std::memcpy(bytes_.data() + at, &offset32, 4);
+            }
+        }
+
+        void byte(std::uint8_t b) { bytes_.push_back(b); }
+        void u32(std::uint32_t value) {
+            for (int i = 0; i < 4; i++) byte(static_cast<std::uint8_t>(value >> (8 * i)));
+        }
+        void u64(std::uint64_t value) {
+            for (int i = 0; i < 8; i++) byte(static_cast<std::uint8_t>(value >> (8 * i)));
+        }
+
+        // REX prefix, which is left out when it would have no effect
+        void rex(bool wide, std::uint8_t reg, std::uint8_t rm, bool isForced = false) {
+            std::uint8_t prefix = static_cast<std::uint8_t>(0x40 | (wide ? 0x8 : 0) | ((reg & 8) >> 1) | ((rm & 8) >> 3));
+            if (prefix != 0x40 || isForced) byte(prefix);
+        }
+        void modrm(std::uint8_t mod, std::uint8_t reg, std::uint8_t rm) {
+            byte(static_cast<std::uint8_t>((mod << 6) | ((reg & 7) << 3) | (rm & 7)));
+        }
+        // op reg, rm (or op rm, reg) with both operands registers
+        void registers(std::uint8_t opcode, bool wide, std::uint8_t reg, std::uint8_t rm) {
+            rex(wide, reg, rm);
+            byte(opcode);
+            modrm(3, reg, rm);
+        }
+        void registers0F(std::uint8_t opcode, bool wide, std::uint8_t reg, std::uint8_t rm) {
+            rex(wide, reg, rm);
+            byte(0x0F);
+            byte(opcode);
+            modrm(3, reg, rm);
+        }
+        // op reg, [base + offset] (or the other way around)
+        void memory(std::uint8_t opcode, bool wide, std::uint8_t reg, std::uint8_t base, std::size_t offset) {
+            rex(wide, reg, base);
+            byte(opcode);
+            modrm(2, reg, base);
+            if ((base & 7) == RSP) byte(0x24);
+            u32(static_cast<std::uint32_t>(offset));
+        }
+
+        void load(Register reg, std::size_t offset) { memory(0x8B, true, reg, CONTEXT, offset); }
+        void store(std::size_t offset, Register reg) { memory(0x89, true, reg, CONTEXT, offset); }
+        void storeImmediate32(std::size_t offset, std::uint32_t value) {
+            memory(0xC7, false, 0, CONTEXT, offset);
+            u32(value);
+        }
+        void mov(Register dst, Register src, bool wide = true) { registers(0x89, wide, src, dst); }
+        void movImmediate(Register dst, std::uint64_t value, bool wide = true) {
+            rex(wide, 0, dst);
+            byte(static_cast<std::uint8_t>(0xB8 + (dst & 7)));
+            if (wide) {
+                u64(value);
+            } else {
+                u32(static_cast<std::uint32_t>(value));
+            }
+        }
+        void add(Register dst, Register src, bool wide) { registers(0x01, wide, src, dst); }
+        void sub(Register dst, Register src, bool wide) { registers(0x29, wide, src, dst); }
+        void andRegisters(Register dst, Register src, bool wide) { registers(0x21, wide, src, dst); }
+        void orRegisters(Register dst, Register src, bool wide) { registers(0x09, wide, src, dst); }
+        void xorRegisters(Register dst, Register src, bool wide) { registers(0x31, wide, src, dst); }
+        void cmp(Register a, Register b, bool wide) { registers(0x39, wide, b, a); }
+        void test(Register a, Register b, bool wide) { registers(0x85, wide, b, a); }
+        void testLowByte(Register reg) { registers(0x84, false, reg, reg); }
+        void inc(Register reg, bool wide) { registers(0xFF, wide, 0, reg); }
+        void dec(Register reg, bool wide) { registers(0xFF, wide, 1, reg); }
+        void imul(Register dst, Register src, bool wide) { registers0F(0xAF, wide, dst, src); }
+        // unsigned division of RDX:RAX
+        void div(Register divisor, bool wide) { registers(0xF7, wide, 6, divisor); }
+        void xorImmediate8(Register reg, std::uint8_t value) {
+            registers(0x83, false, 6, reg);
+            byte(value);
+        }
+        // set the low byte of reg to whether code holds, and zero the rest of it
+        void setcc(ConditionCode code, Register reg) {
+            rex(false, 0, reg, reg >= RSP);
+            byte(0x0F);
+            byte(static_cast<std::uint8_t>(0x90 | code));
+            modrm(3, 0, reg);
+            registers0F(0xB6, false, reg, reg);
+        }
+        void push(Register reg) {
+            rex(false, 0, reg);
+            byte(static_cast<std::uint8_t>(0x50 + (reg & 7)));
+        }
+        void pop(Register reg) {
+            rex(false, 0, reg);
+            byte(static_cast<std::uint8_t>(0x58 + (reg & 7)));
+        }
+        // add (or subtract) a small amount to rsp
+        void adjustStack(std::int8_t amount) {
+            registers(0x83, true, amount < 0 ? 5 : 0, RSP);
+            byte(static_cast<std::uint8_t>(amount < 0 ? -amount : amount));
+        }
+        void ret() { byte(0xC3); }
+        void jmp(Register reg) { registers(0xFF, false, 4, reg); }
+        // call a function at a fixed address, through RAX
+        template <typename Function>
+        void call(Function* function) {
+            movImmediate(RAX, reinterpret_cast<std::uintptr_t>(function));
+            registers(0xFF, false, 2, RAX);
+        }
+        void jmp(std::size_t label) {
+            byte(0xE9);
+            jumpTo(label);
+        }
+        void jcc(ConditionCode code, std::size_t label) {
+            byte(0x0F);
+            byte(static_cast<std::uint8_t>(0x80 | code));
+            jumpTo(label);
+        }
+        // compare the 32-bit value at [reg] with 0
+        void cmpZero32(Register reg) {
+            // [rbp] can only be encoded with an offset
+            rex(false, 0, reg);
+            byte(0x83);
+            modrm(1, 7, reg);
+            byte(0);
+            byte(0);
+        }
+
+    private:
+        void jumpTo(std::size_t label) {
+            jumps_.emplace_back(bytes_.size(), label);
+            u32(0);
+        }
+    };
+
+    // Translates bytecode into native code. The code for each instruction is laid out in order, and
+    // anything it rarely does, such as suspending or handing itself back to its node, goes in a
+    // stub after all of them.
+    class Translator {
+    private:
+        Assembler& as_;
+        const std::vector<Bytecode::Instruction>& code_;
+        // the label at the start of each instruction
+        std::vector<std::size_t> starts_;
+        // the stubs, which are emitted once everything else has been
+        struct Stub {
+            std::size_t label;
+            // return this status (having saved pc if it's SUSPEND), or if it's OKAY, run the node
+            // and then go to resume
+            Status status;
+            std::uint32_t pc;
+            const InstructionNode* node;
+            std::size_t resume;
+        };
+        std::vector<Stub> stubs_;
+        std::size_t epilogue_;
+        std::size_t exit_;
+        std::size_t abort_;
+
+    public:
+        Translator(Assembler& as, const std::vector<Bytecode::Instruction>& code) : as_(as), code_(code) {
+            for (std::size_t i = 0; i < code_.size(); i++) starts_.push_back(as_.newLabel());
+            epilogue_ = as_.newLabel();
+            exit_ = as_.newLabel();
+            abort_ = as_.newLabel();
+        }
+
+        // Emit everything, returning where each instruction starts
+        std::vector<std::uint32_t> translate() {
+            prologue();
+            std::vector<std::uint32_t> starts;
+            for (std::uint32_t pc = 0; pc < code_.size(); pc++) {
+                starts.push_back(static_cast<std::uint32_t>(as_.size()));
+                as_.place(starts_[pc]);
+                instruction(pc);
+            }
+            for (const Stub& stub : stubs_) emitStub(stub);
+            as_.place(exit_);
+            leave(Status::EXIT);
+            as_.place(abort_);
+            leave(Status::ABORT);
+            epilogue();
+            as_.link();
+            return starts;
+        }
+
+    private:
+        // Entry(context, start): save the registers we use, load the program's registers, and jump
+        // to start
+        void prologue() {
+            for (Register reg : {RBX, RBP, R12, R13, R14, R15}) as_.push(reg);
+            // keep the stack 16-byte aligned for calls
+            as_.adjustStack(-8);
+            as_.mov(CONTEXT, RDI);
+            loadRegisters();
+            as_.movImmediate(IS_REQUESTED, reinterpret_cast<std::uintptr_t>(&Checkpoint::isRequested));
+            as_.jmp(RSI);
+        }
+        // return the status in EAX
+        void epilogue() {
+            as_.place(epilogue_);
+            storeRegisters();
+            as_.adjustStack(8);
+            for (Register reg : {R15, R14, R13, R12, RBP, RBX}) as_.pop(reg);
+            as_.ret();
+        }
+        void leave(Status status) {
+            as_.movImmediate(RAX, static_cast<std::uint32_t>(status), false);
+            as_.jmp(epilogue_);
+        }
+        void loadRegisters() {
+            as_.load(ACC, offsetof(Context, acc));
+            as_.load(COND, offsetof(Context, cond));
+            as_.load(MEMORY_PTR, offsetof(Context, memoryPtr));
+            as_.load(UNTIL_CHECKPOINT, offsetof(Context, untilCheckpoint));
+        }
+        void storeRegisters() {
+            as_.store(offsetof(Context, acc), ACC);
+            as_.store(offsetof(Context, cond), COND);
+            as_.store(offsetof(Context, memoryPtr), MEMORY_PTR);
+            as_.store(offsetof(Context, untilCheckpoint), UNTIL_CHECKPOINT);
+        }
+
+        std::size_t addStub(Status status, std::uint32_t pc, const InstructionNode* node = nullptr, std::size_t resume = 0) {
+            std::size_t label = as_.newLabel();
+            stubs_.push_back({label, status, pc, node, resume});
+            return label;
+        }
+        void emitStub(const Stub& stub) {
+            as_.place(stub.label);
+            if (stub.status == Status::SUSPEND) {
+                as_.storeImmediate32(offsetof(Context, pc), stub.pc);
+                leave(Status::SUSPEND);
+            } else {
+                runSource(stub.node);
+                as_.jmp(stub.resume);
+            }
+        }
+        // hand an instruction back to its node, returning its status unless it's OKAY
+        void runSource(const InstructionNode* node) {
+            storeRegisters();
+            as_.mov(RDI, CONTEXT);
+            as_.movImmediate(RSI, reinterpret_cast<std::uintptr_t>(node));
+            as_.call(runNode);
+            loadRegisters();
+            as_.test(RAX, RAX, false);
+            as_.jcc(NOT_EQUAL, epilogue_);
+        }
+        // call a function of the memory pointer (and the operand, if hasOperand)
+        template <typename Function>
+        void callWithCell(Function* function, bool hasOperand = false) {
+            if (hasOperand) as_.mov(RSI, OPERAND);
+            as_.mov(RDI, MEMORY_PTR);
+            as_.call(function);
+        }
+        void loadOperand(const Bytecode::Instruction& instr) {
+            switch (instr.operand) {
+            case Kind::CONSTANT:
+                as_.movImmediate(OPERAND, instr.value, WIDE);
+                break;
+            case Kind::ACCUMULATOR:
+                as_.mov(OPERAND, ACC, WIDE);
+                break;
+            case Kind::MEMORY_CELL:
+                callWithCell(getVal);
+                break;
+            }
+        }
+        // set the conditional register to (COND op operand != 0)
+        void logic(void (Assembler::*op)(Register, Register, bool)) {
+            as_.test(OPERAND, OPERAND, WIDE);
+            as_.setcc(NOT_EQUAL, OPERAND);
+            (as_.*op)(COND, OPERAND, false);
+        }
+        void compare(ConditionCode code) {
+            as_.cmp(ACC, OPERAND, WIDE);
+            as_.setcc(code, COND);
+        }
+
+        void instruction(std::uint32_t pc) {
+            const Bytecode::Instruction& instr = code_[pc];
+            // jumps and skipped blocks go straight on to their targets, without counting as an
+            // instruction
+            switch (instr.op) {
+            case Op::Block:
+                skipTo(instr, starts_[instr.target]);
+                return;
+            case Op::Jump:
+                as_.jmp(starts_[instr.target]);
+                return;
+            case Op::Exit:
+                as_.jmp(exit_);
+                return;
+            default:
+                break;
+            }
+
+            std::size_t finished = as_.newLabel();
+            skipTo(instr, finished);
+            // the node reports the errors which native code doesn't
+            auto error = [this, &instr, finished]() { return addStub(Status::OKAY, 0, instr.source, finished); };
+            bool usesMemory = true;
+            if (instr.op >= Op::SetAccumulator && instr.op <= Op::MemoryForward) loadOperand(instr);
+
+            switch (instr.op) {
+            case Op::Break:
+                as_.jmp(starts_[instr.target]);
+                break;
+            case Op::End:
+                usesMemory = false;
+                break;
+            case Op::Increment:
+                as_.inc(ACC, WIDE);
+                usesMemory = false;
+                break;
+            case Op::Decrement:
+                as_.test(ACC, ACC, WIDE);
+                as_.jcc(EQUAL, error());
+                as_.dec(ACC, WIDE);
+                usesMemory = false;
+                break;
+            case Op::Invert:
+                as_.xorImmediate8(COND, 1);
+                usesMemory = false;
+                break;
+            case Op::MemoryUp:
+                callWithCell(ascend);
+                as_.mov(MEMORY_PTR, RAX);
+                callWithCell(isTop);
+                as_.testLowByte(RAX);
+                as_.jcc(NOT_EQUAL, exit_);
+                break;
+            case Op::MemoryDown:
+                callWithCell(descend);
+                as_.test(RAX, RAX, true);
+                as_.jcc(EQUAL, error());
+                as_.mov(MEMORY_PTR, RAX);
+                break;
+            case Op::MemoryPrev:
+                callWithCell(getPrev);
+                as_.mov(MEMORY_PTR, RAX);
+                break;
+            case Op::MemoryNext:
+                callWithCell(getNext);
+                as_.mov(MEMORY_PTR, RAX);
+                break;
+            case Op::MemoryRestart:
+                callWithCell(restart);
+                as_.mov(MEMORY_PTR, RAX);
+                break;
+            case Op::MemoryRotate:
+                callWithCell(makeFirst);
+                break;
+            case Op::SetAccumulator:
+                as_.mov(ACC, OPERAND, WIDE);
+                usesMemory = false;
+                break;
+            case Op::SetConditional:
+                as_.test(OPERAND, OPERAND, WIDE);
+                as_.setcc(NOT_EQUAL, COND);
+                usesMemory = false;
+                break;
+            case Op::SetMemoryVal:
+                callWithCell(setVal, true);
+                break;
+            case Op::Add:
+                as_.add(ACC, OPERAND, WIDE);
+                usesMemory = false;
+                break;
+            case Op::Subtract:
+                as_.cmp(ACC, OPERAND, WIDE);
+                as_.jcc(BELOW, error());
+                as_.sub(ACC, OPERAND, WIDE);
+                usesMemory = false;
+                break;
+            case Op::ReverseSubtract:
+                as_.cmp(ACC, OPERAND, WIDE);
+                as_.jcc(ABOVE, error());
+                as_.sub(OPERAND, ACC, WIDE);
+                as_.mov(ACC, OPERAND, WIDE);
+                usesMemory = false;
+                break;
+            case Op::Multiply:
+                as_.imul(ACC, OPERAND, WIDE);
+                usesMemory = false;
+                break;
+            case Op::Divide:
+            case Op::Modulo:
+                as_.test(OPERAND, OPERAND, WIDE);
+                as_.jcc(EQUAL, error());
+                as_.mov(RCX, OPERAND);
+                as_.mov(RAX, ACC, WIDE);
+                as_.xorRegisters(RDX, RDX, false);
+                as_.div(RCX, WIDE);
+                as_.mov(ACC, instr.op == Op::Divide ? RAX : RDX, WIDE);
+                usesMemory = false;
+                break;
+            case Op::ReverseDivide:
+            case Op::ReverseModulo:
+                as_.test(ACC, ACC, WIDE);
+                as_.jcc(EQUAL, error());
+                as_.xorRegisters(RDX, RDX, false);
+                as_.div(ACC, WIDE);
+                as_.mov(ACC, instr.op == Op::ReverseDivide ? RAX : RDX, WIDE);
+                usesMemory = false;
+                break;
+            case Op::And:
+                logic(&Assembler::andRegisters);
+                usesMemory = false;
+                break;
+            case Op::Or:
+                logic(&Assembler::orRegisters);
+                usesMemory = false;
+                break;
+            case Op::Xor:
+                logic(&Assembler::xorRegisters);
+                usesMemory = false;
+                break;
+            case Op::Greater:
+                compare(ABOVE);
+                usesMemory = false;
+                break;
+            case Op::Equal:
+                compare(EQUAL);
+                usesMemory = false;
+                break;
+            case Op::Less:
+                compare(BELOW);
+                usesMemory = false;
+                break;
+            case Op::GreaterOrEqual:
+                compare(ABOVE_OR_EQUAL);
+                usesMemory = false;
+                break;
+            case Op::LessOrEqual:
+                compare(BELOW_OR_EQUAL);
+                usesMemory = false;
+                break;
+            case Op::NotEqual:
+                compare(NOT_EQUAL);
+                usesMemory = false;
+                break;
+            case Op::MemoryBack:
+                callWithCell(shiftBack, true);
+                as_.mov(MEMORY_PTR, RAX);
+                break;
+            case Op::MemoryForward:
+                callWithCell(shiftForward, true);
+                as_.mov(MEMORY_PTR, RAX);
+                break;
+
+            // input and output, inserting and deleting, and setting memory to a literal
+            default:
+                runSource(instr.source);
+                break;
+            }
+
+            // an instruction has finished, so do what a block does between instructions
+            as_.place(finished);
+            if (usesMemory) {
+                as_.store(offsetof(Context, memoryPtr), MEMORY_PTR);
+                as_.mov(RDI, CONTEXT);
+                as_.call(tidyMemory);
+                as_.load(MEMORY_PTR, offsetof(Context, memoryPtr));
+                as_.testLowByte(RAX);
+                as_.jcc(NOT_EQUAL, abort_);
+            }
+            std::size_t suspend = addStub(Status::SUSPEND, pc + 1);
+            as_.dec(UNTIL_CHECKPOINT, true);
+            as_.jcc(EQUAL, suspend);
+            as_.cmpZero32(IS_REQUESTED);
+            as_.jcc(NOT_EQUAL, suspend);
+        }
+
+        // jump to label if the instruction's condition doesn't hold
+        void skipTo(const Bytecode::Instruction& instr, std::size_t label) {
+            if (instr.skip == 0) return;
+            as_.test(COND, COND, false);
+            as_.jcc(instr.skip == Bytecode::SKIP_WHEN_FALSE ? EQUAL : NOT_EQUAL, label);
+        }
+    };
+}
+
+bool Jit::isSupported() {
+#if defined(__x86_64__) && defined(__linux__) && SPHEREHORN_CELL_BITS >= 32
+    return true;
+#else
+    return false;
+#endif
+}
+
+Jit::Jit(const Bytecode& bytecode) : bytecode_(bytecode) {
+    if (!isSupported()) throw std::runtime_error("native code isn't supported by this build");
+    Assembler as;
+    starts_ = Translator(as, bytecode.instructions()).translate();
+
+    // the code is written while the memory is writable, and then made executable instead
+    std::size_t pageSize = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    size_ = (as.size() + pageSize - 1) / pageSize * pageSize;
+    void* memory = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) throw std::runtime_error("memory for native code could not be mapped");
+    std::memcpy(memory, as.bytes().data(), as.size());
+    if (mprotect(memory, size_, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size_);
+        throw std::runtime_error("memory for native code could not be made executable");
+    }
+    code_ = memory;
+}
+
+Jit::~Jit() {
+    munmap(code_, size_);
+}
+
+Status Jit::run(ProgramState& state) const {
+    std::uint32_t pc = 0;
+    if (state.isResuming()) {
+        pc = bytecode_.resumePoint(state);
+        state.position.clear();
+        state.resumeDepth = 0;
+    }
+    Context context {state.accRegister, state.condRegister, state.memoryPtr, state.untilCheckpoint, &state, 0};
+    Entry entry = reinterpret_cast<Entry>(code_);
+    Status result = entry(&context, static_cast<const std::uint8_t*>(code_) + starts_[pc]);
+    state.accRegister = toNum(context.acc);
+    state.condRegister = context.cond != 0;
+    state.memoryPtr = context.memoryPtr;
+    state.untilCheckpoint = context.untilCheckpoint;
+    if (result == Status::SUSPEND) bytecode_.suspend(context.pc, state);
+    return result;
+}
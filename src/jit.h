@@ -0,0 +1,59 @@
+// jit.h
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "definitions.h"
+#include "program_state.h"
+#include "instruction_container.h"
+#include "bytecode.h"
+
+namespace spherehorn {
+
+// A program's bytecode translated into x86-64 machine code, which runs with the accumulator, the
+// conditional register, the memory pointer and the checkpoint countdown kept in machine registers.
+//
+// Each bytecode instruction becomes a short run of native instructions, and jumps between blocks
+// become native jumps. Arithmetic, comparisons and conditions are done inline; moving around the
+// memory tree calls MemoryCell's own functions. Everything else (input and output, inserting and
+// deleting, setting memory to a literal, and reporting errors) is handed back to the instruction's
+// node, just as Bytecode::run() does. Native code suspends for checkpoints at the same points as
+// the bytecode, with the same ProgramState::position.
+//
+// Between instructions, the memory is only tidied and checked against the limit on cells after
+// instructions which use it, since nothing else can change it.
+class Jit {
+public:
+    // Whether to run programs as native code: always (failing if it isn't supported), never, or
+    // whenever it's supported
+    enum struct Mode : std::uint8_t {
+        OFF,
+        ON,
+        AUTO,
+    };
+
+private:
+    const Bytecode& bytecode_;
+    // the native code, in memory which is mapped executable, and where each bytecode instruction
+    // starts in it
+    void* code_ = nullptr;
+    std::size_t size_ = 0;
+    std::vector<std::uint32_t> starts_;
+
+public:
+    // Whether this build can run native code, i.e. whether it's for x86-64 Linux with cells of 32
+    // or 64 bits
+    static bool isSupported();
+    // Translate bytecode, which must outlive this. Throws std::runtime_error if native code isn't
+    // supported, or if it can't be mapped.
+    Jit(const Bytecode& bytecode);
+    Jit(const Jit&) = delete;
+    Jit& operator =(const Jit&) = delete;
+    ~Jit();
+    // Run the program, with the same result as Bytecode::run()
+    Status run(ProgramState& state) const;
+};
+
+}
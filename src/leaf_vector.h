@@ -0,0 +1,44 @@
+// leaf_vector.h
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "definitions.h"
+#include "memory_cell.h"
+
+namespace spherehorn {
+
+// The values of a PACKED cell's children (see MemoryCell::Layout). Strings are by far the most
+// common loops whose children are all leaves, and storing them as a plain array takes a few bytes
+// per character rather than a whole cell, and lets them be read and written in bulk.
+class LeafVector {
+private:
+    std::vector<num> values_;
+#ifdef SPHEREHORN_COMPACT_CELLS
+    std::uint32_t id_ = LeafLink::add(this);
+#endif
+
+public:
+    // the values are counted as part of the cell pool's memory, since they stand in for cells
+    LeafVector(std::vector<num>&& values) : values_(std::move(values)) { MemoryCell::pool().charge(numBytes()); }
+    LeafVector(const LeafVector&) = delete;
+    LeafVector& operator =(const LeafVector&) = delete;
+    ~LeafVector() {
+        MemoryCell::pool().refund(numBytes());
+#ifdef SPHEREHORN_COMPACT_CELLS
+        LeafLink::remove(id_);
+#endif
+    }
+    const std::vector<num>& values() const { return values_; }
+    std::size_t numBytes() const { return sizeof(LeafVector) + values_.capacity() * sizeof(num); }
+
+#ifdef SPHEREHORN_COMPACT_CELLS
+    // the vector's entry in LeafLink::table()
+    constexpr std::uint32_t id() const { return id_; }
+#endif
+};
+
+}
@@ -0,0 +1,50 @@
+// literal_pool.cpp
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "definitions.h"
+#include "memory_cell.h"
+#include "literal_pool.h"
+using namespace spherehorn;
+
+SharedTree* LiteralPool::intern(MemoryCell&& root) {
+    auto [it, isNew] = trees_.try_emplace(keyOf(root), nullptr);
+    if (isNew) it->second = SharedTree::create(std::move(root));
+    it->second->addRef();
+    return it->second;
+}
+
+std::string LiteralPool::keyOf(MemoryCell& cell) {
+    std::string key = std::to_string(wide_num{cell.getVal()});
+    if (const std::vector<num>* leaves = cell.getLeaves()) {
+        key += " packed";
+        for (num leaf : *leaves) key += ' ' + std::to_string(wide_num{leaf});
+        return key;
+    }
+    if (cell.numChildrenInstantiated == 0) return key;
+    // parsed literals are full loops, so this doesn't instantiate anything
+    MemoryCell* first = cell.getChild();
+    MemoryCell* child = first;
+    do {
+        if (child->numChildrenInstantiated != 0 && !child->isShared()) {
+            SharedTree* tree = intern(std::move(*child));
+            child->share(*tree);
+            tree->release();
+        }
+        key += ' ' + std::to_string(wide_num{child->getVal()});
+        // an interned tree stands for every tree with the same structure
+        if (child->isShared()) {
+            const MemoryCell* source = child->sharedSource;
+            key += '@' + std::to_string(reinterpret_cast<std::uintptr_t>(source));
+        }
+        child = child->getNext();
+    } while (child != first);
+    return key;
+}
+
+void LiteralPool::clear() {
+    for (auto& [image, tree] : trees_) tree->release();
+    trees_.clear();
+}
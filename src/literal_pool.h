@@ -0,0 +1,38 @@
+// literal_pool.h
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include "memory_cell.h"
+
+namespace spherehorn {
+
+// Interns the memory literals of `.` instructions while a program is being parsed, so that every
+// instruction whose literal has the same structure shares a single SharedTree. This works from the
+// bottom up: each of a literal's elements which has elements of its own is interned first, and
+// replaced with a SHARED reference to the result, so equal parts of different literals are only
+// stored once too. A cell's key is then just its value and those of its children, along with the
+// trees the children share, so each cell is only looked at once however deep it is.
+class LiteralPool {
+private:
+    std::unordered_map<std::string, SharedTree*> trees_;
+
+    // Intern each of cell's children which has children of its own, and return cell's key
+    std::string keyOf(MemoryCell& cell);
+
+public:
+    LiteralPool() {}
+    LiteralPool(const LiteralPool&) = delete;
+    LiteralPool& operator =(const LiteralPool&) = delete;
+    ~LiteralPool() { clear(); }
+    // Return a tree whose root is equal to root, which the caller holds a new reference to. root
+    // is only used if no such tree exists yet.
+    SharedTree* intern(MemoryCell&& root);
+    std::size_t size() const { return trees_.size(); }
+    // Let go of the pool's own references to its trees, e.g. once parsing is finished
+    void clear();
+};
+
+}
@@ -1,22 +1,159 @@
 // main.cpp
 
+#include <charconv>
+#include <csignal>
+#include <cstddef>
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
+#include <string>
 #include <utility>
+#include <vector>
+#include "cell_pool.h"
+#include "checkpoint.h"
+#include "memory_cell.h"
+#include "jit.h"
 #include "program.h"
 
 const int EX_USAGE = 64;
 const int EX_NOINPUT = 66;
+const int EX_CANTCREAT = 73;
+const std::size_t DUMP_BUFFER_SIZE = 1 << 20;
+
+// Parse the value of an option of the form --name=VALUE, returning false if it isn't a number
+bool parseOptionValue(const std::string& option, std::size_t& value) {
+    const char* start = option.data() + option.find('=') + 1;
+    const char* end = option.data() + option.size();
+    auto [ptr, error] = std::from_chars(start, end, value);
+    return error == std::errc() && ptr == end && ptr != start;
+}
+
+void requestCheckpoint(int) {
+    spherehorn::Checkpoint::request();
+}
+
+// Write the program's memory to the given file, returning false if it couldn't be written
+bool dumpMemory(const spherehorn::Program& program, const std::string& path, bool binary) {
+    // trees can be huge, so write them through a much bigger buffer than the default
+    std::vector<char> buffer (DUMP_BUFFER_SIZE);
+    std::ofstream output;
+    output.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    output.open(path, binary ? std::ios::binary : std::ios::out);
+    if (!output.is_open()) return false;
+    program.dumpMemory(output, binary);
+    output.close();
+    return !output.fail();
+}
+
+// the bytes include the indexes and packed leaves that cells keep their children in
+void printMemoryStats() {
+    const spherehorn::CellPool& pool = spherehorn::MemoryCell::pool();
+    std::cerr << "Memory: " << pool.numLive() << " cells (" << pool.numBytes() << " bytes) live at exit, peak of "
+              << pool.peakLive() << " cells (" << pool.peakBytes() << " bytes)" << std::endl;
+}
 
 int main(int argc, char** argv) {
-    if (argc != 2) {
-        std::cerr << "USAGE: " << argv[0] << " FILE" << std::endl;
+    // any options come before the file name
+    int fileArg = 1;
+    bool isUsageError = false;
+    bool showMemoryStats = false;
+    std::string checkpointPath;
+    std::size_t checkpointInterval = 0;
+    std::string restorePath;
+    std::string memoryPath;
+    std::string loadPath;
+    bool isLoadImage = false;
+    std::string dumpPath;
+    bool isDumpBinary = false;
+    std::string emitPath;
+    bool useBytecode = false;
+    spherehorn::Jit::Mode jitMode = spherehorn::Jit::Mode::OFF;
+    for (; fileArg < argc && std::string(argv[fileArg]).starts_with("--"); fileArg++) {
+        std::string option = argv[fileArg];
+        if (option == "--bytecode") {
+            // run the program as bytecode instead of walking its tree of instructions
+            useBytecode = true;
+        } else if (option.starts_with("--jit=")) {
+            // translate the bytecode to native code: always, never, or whenever this machine can
+            std::string mode = option.substr(option.find('=') + 1);
+            if (mode == "on") {
+                jitMode = spherehorn::Jit::Mode::ON;
+            } else if (mode == "off") {
+                jitMode = spherehorn::Jit::Mode::OFF;
+            } else if (mode == "auto") {
+                jitMode = spherehorn::Jit::Mode::AUTO;
+            } else {
+                isUsageError = true;
+            }
+        } else if (option == "--deferred-free") {
+            // free discarded memory a little at a time between instructions
+            spherehorn::MemoryCell::setDeferredReclamation(true);
+        } else if (option == "--compact-memory") {
+            // move the memory tree's cells back into order whenever they've become scattered
+            spherehorn::MemoryCell::setAutoCompaction(true);
+        } else if (option.starts_with("--memory-file=")) {
+            // keep the memory tree in this file rather than in RAM
+            memoryPath = option.substr(option.find('=') + 1);
+            if (memoryPath.empty()) isUsageError = true;
+        } else if (option.starts_with("--load-memory=") || option.starts_with("--load-string=")) {
+            // start with the memory in this file (a binary dump, or raw bytes as a string) instead
+            // of the memory literal in the program
+            loadPath = option.substr(option.find('=') + 1);
+            isLoadImage = option.starts_with("--load-memory=");
+            if (loadPath.empty()) isUsageError = true;
+        } else if (option.starts_with("--dump-memory=")) {
+            // write the program's memory to this file when it ends, however it ends
+            dumpPath = option.substr(option.find('=') + 1);
+            if (dumpPath.empty()) isUsageError = true;
+        } else if (option.starts_with("--emit-cpp=")) {
+            // write the program out as C++ to this file instead of running it
+            emitPath = option.substr(option.find('=') + 1);
+            if (emitPath.empty()) isUsageError = true;
+        } else if (option == "--dump-binary") {
+            isDumpBinary = true;
+        } else if (option.starts_with("--max-cells=")) {
+            // abort the program if it ever uses more memory than this many cells would
+            std::size_t maxCells = 0;
+            if (!parseOptionValue(option, maxCells)) isUsageError = true;
+            spherehorn::MemoryCell::pool().setLimit(maxCells);
+        } else if (option == "--memory-stats") {
+            showMemoryStats = true;
+        } else if (option.starts_with("--checkpoint=")) {
+            // save checkpoints to this file when sent SIGUSR1, or every --checkpoint-every instructions
+            checkpointPath = option.substr(option.find('=') + 1);
+            if (checkpointPath.empty()) isUsageError = true;
+        } else if (option.starts_with("--checkpoint-every=")) {
+            if (!parseOptionValue(option, checkpointInterval)) isUsageError = true;
+        } else if (option.starts_with("--restore=")) {
+            // carry on from a checkpoint saved by an earlier run of the same program
+            restorePath = option.substr(option.find('=') + 1);
+            if (restorePath.empty()) isUsageError = true;
+        } else {
+            isUsageError = true;
+        }
+    }
+    if (checkpointInterval != 0 && checkpointPath.empty()) isUsageError = true;
+    if (isDumpBinary && dumpPath.empty()) isUsageError = true;
+    if (isUsageError || argc - fileArg != 1) {
+        std::cerr << "USAGE: " << argv[0] << " [--bytecode] [--jit=on|off|auto] [--deferred-free] [--compact-memory] [--memory-file=FILE] [--max-cells=N] [--memory-stats]"
+                     " [--checkpoint=FILE [--checkpoint-every=N]] [--restore=FILE]"
+                     " [--load-memory=FILE | --load-string=FILE]"
+                     " [--dump-memory=FILE [--dump-binary]] [--emit-cpp=FILE] FILE" << std::endl;
         return EX_USAGE;
     }
 
-    std::ifstream input (argv[1]);
+    if (!memoryPath.empty()) {
+        if (!spherehorn::MemoryCell::pool().mapFile(memoryPath, spherehorn::CellPool::MAX_REGION_SLOTS)) {
+            std::cerr << "File error: file " << memoryPath << " could not be mapped" << std::endl;
+            return EX_CANTCREAT;
+        }
+        // the kernel pages the tree in and out a page at a time, so keep it in the order it's walked
+        spherehorn::MemoryCell::setAutoCompaction(true);
+    }
+
+    std::ifstream input (argv[fileArg]);
     if (!input.is_open()) {
-        std::cerr << "File error: file " << argv[1] << " could not be opened" << std::endl;
+        std::cerr << "File error: file " << argv[fileArg] << " could not be opened" << std::endl;
         return EX_NOINPUT;
     }
 
@@ -27,7 +164,55 @@ int main(int argc, char** argv) {
         return 2; // return code for a parse error
     }
 
+    if (useBytecode || jitMode != spherehorn::Jit::Mode::OFF) {
+        try {
+            program.compile(jitMode);
+        } catch (const std::runtime_error& error) {
+            std::cerr << "Compile error: " << error.what() << std::endl;
+            return 2; // the same as for a parse error
+        }
+    }
+    if (!loadPath.empty()) {
+        try {
+            program.loadMemory(loadPath, isLoadImage);
+        } catch (const std::runtime_error& error) {
+            std::cerr << "File error: " << error.what() << std::endl;
+            return EX_NOINPUT;
+        }
+    }
+    if (!emitPath.empty()) {
+        std::ofstream output (emitPath);
+        if (output.is_open()) program.emitCpp(output);
+        output.close();
+        if (!output) {
+            std::cerr << "File error: file " << emitPath << " could not be written" << std::endl;
+            return EX_CANTCREAT;
+        }
+        return 0;
+    }
+    if (!restorePath.empty()) {
+        std::ifstream checkpoint (restorePath, std::ios::binary);
+        if (!checkpoint.is_open()) {
+            std::cerr << "File error: file " << restorePath << " could not be opened" << std::endl;
+            return EX_NOINPUT;
+        }
+        try {
+            program.restore(checkpoint);
+        } catch (const std::runtime_error& error) {
+            std::cerr << "Checkpoint error: " << error.what() << std::endl;
+            return EX_NOINPUT;
+        }
+    }
+    if (!checkpointPath.empty()) {
+        program.enableCheckpoints(checkpointPath, checkpointInterval);
+        std::signal(SIGUSR1, requestCheckpoint);
+    }
+
     spherehorn::Status exitStatus = program.run();
+    if (showMemoryStats) printMemoryStats();
+    if (!dumpPath.empty() && !dumpMemory(program, dumpPath, isDumpBinary)) {
+        std::cerr << "File error: memory could not be written to " << dumpPath << std::endl;
+    }
     return exitStatus == spherehorn::Status::EXIT ? 0 : 1;
 }
 
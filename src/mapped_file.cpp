@@ -0,0 +1,40 @@
+// mapped_file.cpp
+
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mapped_file.h"
+using namespace spherehorn;
+
+
+MappedFile::MappedFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) throw std::runtime_error("file " + path + " could not be opened");
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw std::runtime_error("file " + path + " could not be read");
+    }
+    size_ = static_cast<std::size_t>(info.st_size);
+    // empty files can't be mapped, but there's nothing to map anyway
+    if (size_ != 0) {
+        void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("file " + path + " could not be mapped");
+        }
+        // it's going to be read from start to end, so the kernel can read ahead
+        madvise(data, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const char*>(data);
+    }
+    buffer_.view(data_, size_);
+    // the mapping stays valid once the file is closed
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr) munmap(const_cast<char*>(data_), size_);
+}
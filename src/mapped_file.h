@@ -0,0 +1,42 @@
+// mapped_file.h
+
+#pragma once
+
+#include <cstddef>
+#include <istream>
+#include <streambuf>
+#include <string>
+
+namespace spherehorn {
+
+// A whole file mapped read-only into memory, so that it can be read in bulk without being copied
+// through a stream buffer first. It can still be read as a stream, for code which expects one.
+class MappedFile {
+private:
+    // a stream buffer whose contents are the mapping itself
+    class Buffer : public std::streambuf {
+    public:
+        void view(const char* data, std::size_t size) {
+            char* begin = const_cast<char*>(data);
+            setg(begin, begin, begin + size);
+        }
+    };
+
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+    Buffer buffer_;
+    std::istream stream_ {&buffer_};
+
+public:
+    // Map the file at the given path, throwing std::runtime_error if it can't be opened or mapped
+    explicit MappedFile(const std::string& path);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator =(const MappedFile&) = delete;
+    ~MappedFile();
+    const unsigned char* bytes() const { return reinterpret_cast<const unsigned char*>(data_); }
+    constexpr std::size_t size() const { return size_; }
+    // an istream which reads the file from the start
+    std::istream& stream() { return stream_; }
+};
+
+}
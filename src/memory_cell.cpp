@@ -1,20 +1,38 @@
 // memory_cell.cpp
 
+#include <cstddef>
+#include <new>
 #include <string>
+#include <utility>
+#include <vector>
 #include "definitions.h"
+#include "cell_pool.h"
 #include "memory_cell.h"
+#include "child_index.h"
+#include "leaf_vector.h"
 using namespace spherehorn;
 using std::string;
 
-
-MemoryCell::MemoryCell(const string& str) : value(str.size()) {
-    if (str.size() == 0) return;
-
-    MemoryCell* currChild = getChild();
-    for (unsigned int i = 0; i < str.size(); i++) {
-        currChild->setVal(static_cast<num>(str.at(i)));
-        currChild = currChild->getNext();
-    }
+#ifdef SPHEREHORN_COMPACT_CELLS
+// CellLinks are turned into pointers by scaling by sizeof(MemoryCell), so the pool mustn't pad slots
+static_assert(sizeof(MemoryCell) % alignof(void*) == 0, "compact MemoryCells must fill their pool slots exactly");
+#else
+// TaggedLinks keep their tags in the low bits of pointers to these
+static_assert(alignof(MemoryCell) >= 8 && sizeof(MemoryCell) % 8 == 0, "MemoryCells must be 8-byte aligned");
+static_assert(alignof(ChildIndex) >= 8 && alignof(LeafVector) >= 8, "ChildIndex and LeafVector must be 8-byte aligned");
+#endif
+
+std::vector<MemoryCell*> MemoryCell::garbage;
+bool MemoryCell::isReclamationDeferred = false;
+bool MemoryCell::isCompactionAutomatic = false;
+std::size_t MemoryCell::recycledAtCompaction = 0;
+
+
+MemoryCell::MemoryCell(const string& str) {
+    std::vector<num> values;
+    values.reserve(str.size());
+    for (char c : str) values.push_back(static_cast<num>(c));
+    setLeaves(std::move(values));
 }
 
 MemoryCell& MemoryCell::operator =(const MemoryCell& other) {
@@ -22,42 +40,75 @@ MemoryCell& MemoryCell::operator =(const MemoryCell& other) {
     if (this == &other) return *this;
 
     setVal(other.getVal());
+    // other's children are immutable if it's SHARED, so we can share them too
+    if (other.isShared()) {
+        shareNode(other.sharedSource);
+        return *this;
+    }
+    // Copy the tree one level at a time, keeping the cells whose children still need to be copied on
+    // an explicit stack rather than recursing, so that deep trees don't use up the C++ stack
+    std::vector<PendingCopy> pending;
+    copyChildren(other, &pending);
+    while (!pending.empty()) {
+        auto [copy, original] = pending.back();
+        pending.pop_back();
+        if (original->isShared()) {
+            copy->shareNode(original);
+        } else {
+            copy->copyChildren(*original, &pending);
+        }
+    }
+    return *this;
+}
+
+void MemoryCell::copyChildren(const MemoryCell& other, std::vector<PendingCopy>* pending) {
     // if other doesn't have any instantiated children, we're done
-    if (other.numChildrenInstantiated == 0) return *this;
+    if (other.numChildrenInstantiated == 0) return;
     // otherwise we need to make copies of other's children
 
     numChildrenInstantiated = other.numChildrenInstantiated; // this isn't true yet, but it will be once we're done
+    // PACKED children are just an array of values
+    if (other.isPacked()) {
+        setLayout(Layout::PACKED);
+        leaves = new LeafVector(std::vector<num>(other.leaves->values()));
+        return;
+    }
+    // INDEXED children may be scattered around the loop, so they need to go into an index too
+    if (other.isIndexed()) {
+        ChildIndex* index = new ChildIndex(other.value, other.numChildrenInstantiated);
+        other.childIndex->forEach([this, index, pending](num pos, MemoryCell* otherChild) {
+            MemoryCell* thisChild = copyOf(*otherChild, pending);
+            thisChild->parent = this;
+            index->set(pos, thisChild);
+        });
+        index->setFirst(other.childIndex->first());
+        setLayout(Layout::INDEXED);
+        childIndex = index;
+        return;
+    }
     // make a copy of other's first child so that we have a starting point
-    firstChild = new MemoryCell(*other.firstChild);
+    firstChild = copyOf(*other.firstChild, pending);
     firstChild->parent = this; // make sure to set the parent
 
-    // iterate forwards over other's children, starting with the child after the first
-    MemoryCell* otherCurrChild = nullptr;
-    MemoryCell* thisCurrChild = nullptr;
+    // iterate forwards over other's children, starting with the child after the first, until we
+    // get back round to it, and link each copy up the same way as the original
+    const MemoryCell* otherPrevChild = other.firstChild;
     MemoryCell* thisPrevChild = firstChild;
-    for (otherCurrChild = other.firstChild->nextSibling;
-         otherCurrChild != nullptr && otherCurrChild != other.firstChild;
-         otherCurrChild = otherCurrChild->nextSibling) {
-        thisCurrChild = new MemoryCell(*otherCurrChild); // create a copy of otherCurrChild
-        thisPrevChild->linkNext(thisCurrChild);
+    for (num i = 0; i < numChildrenInstantiated; i++) {
+        const MemoryCell* otherCurrChild = otherPrevChild->nextSibling;
+        MemoryCell* thisCurrChild = firstChild;
+        if (otherCurrChild != other.firstChild) {
+            thisCurrChild = copyOf(*otherCurrChild, pending); // create a copy of otherCurrChild
+            thisCurrChild->parent = this;
+        }
+        if (otherPrevChild->isGapAfter()) {
+            thisPrevChild->linkAcrossGap(thisCurrChild);
+        } else {
+            thisPrevChild->linkNext(thisCurrChild);
+        }
+        otherPrevChild = otherCurrChild;
         thisPrevChild = thisCurrChild;
     }
-    // if we looped all the way around, attach the end to the start and exit
-    if (otherCurrChild == other.firstChild) {
-        thisPrevChild->linkNext(firstChild);
-        return *this;
-    }
-    // otherwise iterate backwards over other's children
-    MemoryCell* thisNextChild = firstChild;
-    for (otherCurrChild = other.firstChild->prevSibling;
-         otherCurrChild != nullptr;
-         otherCurrChild = otherCurrChild->prevSibling) {
-        thisCurrChild = new MemoryCell(*otherCurrChild); // create a copy of otherCurrChild
-        thisNextChild->linkPrev(thisCurrChild);
-        thisNextChild = thisCurrChild;
-    }
-
-    return *this;
 }
 
 MemoryCell& MemoryCell::operator =(MemoryCell&& other) {
@@ -65,104 +116,225 @@ MemoryCell& MemoryCell::operator =(MemoryCell&& other) {
     if (this == &other) return *this;
 
     setVal(other.getVal());
+    // a reference to a shared tree can simply change hands
+    if (other.isShared()) {
+        setLayout(Layout::SHARED);
+        sharedSource = other.sharedSource;
+        other.setLayout(Layout::LINKED);
+        other.firstChild = nullptr;
+        return *this;
+    }
     // if other doesn't have any instantiated children, we're done
     if (other.numChildrenInstantiated == 0) return *this;
     // otherwise we need to move other's children
 
     numChildrenInstantiated = other.numChildrenInstantiated; // this isn't true yet, but it will be once we're done
+    // an array of leaves can simply change hands
+    if (other.isPacked()) {
+        setLayout(Layout::PACKED);
+        leaves = other.leaves;
+        other.setLayout(Layout::LINKED);
+        other.firstChild = nullptr;
+        other.numChildrenInstantiated = 0;
+        return *this;
+    }
+    // an index can simply change hands
+    if (other.isIndexed()) {
+        setLayout(Layout::INDEXED);
+        childIndex = other.childIndex;
+        other.setLayout(Layout::LINKED);
+        other.firstChild = nullptr;
+        other.numChildrenInstantiated = 0;
+        childIndex->forEach([this](num, MemoryCell* child) { child->parent = this; });
+        return *this;
+    }
     firstChild = other.firstChild;
-    firstChild->parent = this;
     // null out other's child pointer to prevent it from deallocating the children when it's destroyed
     other.firstChild = nullptr;
     other.numChildrenInstantiated = 0;
-
-    // iterate forwards over other's children, starting with the child after the first
-    MemoryCell* currChild = nullptr;
-    for (currChild = firstChild->nextSibling;
-         currChild != nullptr && currChild != firstChild;
-         currChild = currChild->nextSibling) {
-        currChild->parent = this;
-    }
-    // if we looped all the way around, then we're done
-    if (currChild == firstChild) return *this;
-    // otherwise iterate backwards over other's children
-    for (currChild = firstChild->prevSibling;
-         currChild != nullptr;
-         currChild = currChild->prevSibling) {
-        currChild->parent = this;
-    }
-
+    forEachChildCell([this](MemoryCell* child) { child->parent = this; });
     return *this;
 }
 
 MemoryCell::~MemoryCell() {
     reset();
+#ifdef SPHEREHORN_COMPACT_CELLS
+    // cells outside the pool (e.g. on the stack) may have been given a reference by one of their
+    // children, which would now dangle
+    if (!pool().inRegion(this)) pool().forgetExternal(this);
+#endif
 }
 
 void MemoryCell::setVal(num _value) {
-    reset();
+    if (isReclamationDeferred) {
+        discardChildren();
+    } else {
+        reset();
+    }
     value = _value;
+    // the statistics were about the children which are now gone
+    setStats(AccessStats{});
 }
 
 void MemoryCell::reset() {
+    // most cells that get reset don't have any children, so don't bother with a work stack for them
+    if (getLayout() == Layout::LINKED && firstChild == nullptr) return;
+    // Destroying the children one at a time with an explicit stack, rather than letting each one's
+    // destructor destroy its own children, means that deep trees don't use up the C++ stack. Each
+    // cell's children are released before the cell is deleted, so its destructor has nothing to do.
+    std::vector<MemoryCell*> released;
+    releaseChildren(released);
+    while (!released.empty()) {
+        MemoryCell* cell = released.back();
+        released.pop_back();
+        cell->releaseChildren(released);
+        delete cell;
+    }
+}
+
+void MemoryCell::releaseChildren(std::vector<MemoryCell*>& released) {
     // store this for later
-    bool wasFull = isFull();
+    num numChildren = numChildrenInstantiated;
     // once this function is finished, this cell will have no instantiated children
     numChildrenInstantiated = 0;
-    // if this cell has no children, then we don't need to do anything
-    if (firstChild == nullptr) return;
-    // if this cell has a single child, then destroy it and return
-    if (value == 1) {
-        delete firstChild;
+    if (isShared()) {
+        const MemoryCell* source = sharedSource;
+        setLayout(Layout::LINKED);
+        firstChild = nullptr;
+        SharedTree::of(source)->release();
+        return;
+    }
+    if (isPacked()) {
+        LeafVector* packed = leaves;
+        delete packed;
+        setLayout(Layout::LINKED);
+        firstChild = nullptr;
+        return;
+    }
+    if (isIndexed()) {
+        ChildIndex* index = childIndex;
+        index->forEach([&released](num, MemoryCell* child) { released.push_back(child); });
+        delete index;
+        setLayout(Layout::LINKED);
         firstChild = nullptr;
         return;
     }
-    // otherwise, destroy all of this node's instantiated children
+    // if this cell has no children, then we don't need to do anything
+    if (firstChild == nullptr) return;
+    // otherwise, release all of this node's instantiated children, which going forwards from the
+    // first child takes us through exactly once (the released cells aren't destroyed yet, so their
+    // links can still be followed)
+    MemoryCell* curr = firstChild;
+    for (num i = 0; i < numChildren; i++) {
+        released.push_back(curr);
+        curr = curr->nextSibling;
+    }
+    firstChild = nullptr;
+}
 
-    // split up the link from the last child to the first child, if it exists
-    MemoryCell* lastChild = firstChild->prevSibling;
-    if (lastChild != nullptr) {
-        lastChild->nextSibling = nullptr;
+void MemoryCell::discardChildren() {
+    if (getLayout() == Layout::LINKED && firstChild == nullptr) return;
+    // releasing a reference to a shared tree or an array of leaves is cheap anyway
+    if (isShared() || isPacked()) {
+        reset();
+        return;
     }
-    // iterate forwards through the loop, starting from the first child
-    MemoryCell* next = nullptr;
-    for (MemoryCell* curr = firstChild; curr != nullptr; curr = next) {
-        next = curr->nextSibling;
-        delete curr;
+    // Move the children over to a new cell without touching them, and leave that for the reclaimer.
+    // The children's parent links will point to this cell rather than the new one, but the only
+    // thing that will ever happen to them now is being destroyed, which doesn't look at them.
+    MemoryCell* detached = new MemoryCell(value);
+    detached->numChildrenInstantiated = numChildrenInstantiated;
+    detached->setLayout(getLayout());
+    if (isIndexed()) {
+        detached->childIndex = childIndex;
+    } else {
+        detached->firstChild = firstChild;
     }
-    // we've deleted the first child, so we should null out this cell's firstChild pointer
+    numChildrenInstantiated = 0;
+    setLayout(Layout::LINKED);
     firstChild = nullptr;
-    // if the loop was full when we started, then we've gone all the way around, so we're done
-    if (wasFull) return;
-    // otherwise, we need to do the same thing but working backwards from lastChild
-    MemoryCell* prev = nullptr;
-    for (MemoryCell* curr = lastChild; curr != nullptr; curr = prev) {
-        prev = curr->prevSibling;
-        delete curr;
+    garbage.push_back(detached);
+}
+
+void MemoryCell::reclaimSome() {
+    // this works just like reset(), except that it stops after a while
+    for (std::size_t i = 0; i < RECLAIM_SLICE && !garbage.empty(); i++) {
+        MemoryCell* cell = garbage.back();
+        garbage.pop_back();
+        cell->releaseChildren(garbage);
+        delete cell;
     }
-    // the node's instantiated children will always be a contiguous segment of the full loop, so
-    // now we can be sure that there are no more children to delete
+}
+
+void MemoryCell::reclaimAll() {
+    while (!garbage.empty()) reclaimSome();
+}
+
+void MemoryCell::compact(MemoryCell& root, MemoryCell*& tracked) {
+    // List the cells so that each loop's children are together, and are followed by their own
+    // children's loops in depth first order. The stack holds the cells whose children haven't been
+    // listed yet, and each cell's children are pushed in reverse so that they come off it in order.
+    std::vector<MemoryCell*> order;
+    std::vector<MemoryCell*> stack {&root};
+    while (!stack.empty()) {
+        MemoryCell* cell = stack.back();
+        stack.pop_back();
+        std::size_t childrenStart = order.size();
+        cell->forEachChildCell([&order](MemoryCell* child) { order.push_back(child); });
+        for (std::size_t i = order.size(); i > childrenStart; i--) stack.push_back(order[i - 1]);
+    }
+
+    // Take every new slot before freeing any of the old ones, so that none of them get reused
+    // straight away. With the free list sorted, the new slots come out in address order.
+    CellPool& cellPool = pool();
+    cellPool.sortFreeList();
+    std::vector<void*> slots;
+    slots.reserve(order.size());
+    for (std::size_t i = 0; i < order.size(); i++) slots.push_back(cellPool.allocate());
+    for (std::size_t i = 0; i < order.size(); i++) {
+        MemoryCell* moved = order[i]->moveTo(slots[i]);
+        if (tracked == order[i]) tracked = moved;
+    }
+    for (MemoryCell* cell : order) delete cell;
+    recycledAtCompaction = cellPool.numRecycled();
 }
 
 MemoryCell* MemoryCell::getChild() {
     // TODO: if this memory cell's value is 0, trying to get its child is an error
+    if (getLayout() != Layout::LINKED) {
+        if (isIndexed()) return indexedChildAt(childIndex->first());
+        // the program is about to look inside a SHARED tree, so it needs its own copy of this level
+        if (isShared()) unshare();
+        // and it's about to point at a child, so that child needs to be a cell
+        if (isPacked()) unpack();
+    }
     // if we already have a child, we can just return it
     if (firstChild != nullptr) return firstChild;
     // otherwise we need to allocate a new child
     firstChild = new MemoryCell(0);
     firstChild->parent = this;
     numChildrenInstantiated = 1;
-    // if we're only going to have a single child, then link that child to itself in a loop
+    // if we're only going to have a single child, then link that child to itself in a loop,
+    // otherwise it's both ends of the segment
     if (value == 1) {
         firstChild->linkNext(firstChild);
+    } else {
+        firstChild->linkAcrossGap(firstChild);
     }
     return firstChild;
 }
 
 MemoryCell* MemoryCell::getPrev() {
+    // INDEXED children don't use their sibling links (and prevSibling is really the slot)
+    if (parent->isIndexed()) {
+        ChildIndex& index = *parent->childIndex;
+        return parent->indexedChildAt(index.back(index.positionOf(this), 1));
+    }
     // if we already have a previous sibling, we can just return it
-    if (prevSibling != nullptr) return prevSibling;
-    // otherwise we need to allocate and link a new sibling
+    if (!isGapBefore()) return prevSibling;
+    // otherwise this cell is the start of the instantiated segment, and prevSibling is the end
+    MemoryCell* segmentEnd = prevSibling;
+    // we need to allocate and link a new sibling
     MemoryCell* newSibling = new MemoryCell(0);
     this->linkPrev(newSibling);
     // if this cell doesn't have a parent, i.e. it's a top-level cell, then we're done
@@ -170,23 +342,27 @@ MemoryCell* MemoryCell::getPrev() {
     //if (parent == nullptr) return prevSibling; // TODO: decide what to do in this case
     // otherwise, we have to inform the parent that we've instantiated a new child
     parent->numChildrenInstantiated++;
-    // if the parent is now full, we need to connect the two ends of the loop together
+    // if the parent is now full, we need to connect the two ends of the loop together, after which
+    // the loop doesn't have ends anymore
     if (parent->isFull()) {
-        MemoryCell* lastSibling = nullptr;
-        for (lastSibling = this;
-             lastSibling->nextSibling != nullptr;
-             lastSibling = lastSibling->nextSibling) {}
-        // lastSibling is now the last sibling in the instantiated siblings, and newSibling is the
-        // first
-        newSibling->linkPrev(lastSibling);
+        newSibling->linkPrev(segmentEnd);
+    } else {
+        // this cell was the start of the instantiated segment, so now newSibling is
+        segmentEnd->linkAcrossGap(newSibling);
     }
 
     return prevSibling;
 }
 
 MemoryCell* MemoryCell::getNext() {
-    // see MemoryCell::prev() for an explanation of how this works
-    if (nextSibling != nullptr) return nextSibling;
+    // see MemoryCell::prev() for an explanation of how this works (INDEXED children have no
+    // nextSibling or gap links, so checking those first is safe)
+    if (nextSibling != nullptr && !isGapAfter()) return nextSibling;
+    if (parent->isIndexed()) {
+        ChildIndex& index = *parent->childIndex;
+        return parent->indexedChildAt(index.forward(index.positionOf(this), 1));
+    }
+    MemoryCell* segmentStart = nextSibling;
 
     MemoryCell* newSibling = new MemoryCell(0);
     this->linkNext(newSibling);
@@ -195,11 +371,9 @@ MemoryCell* MemoryCell::getNext() {
 
     parent->numChildrenInstantiated++;
     if (parent->isFull()) {
-        MemoryCell* firstSibling = nullptr;
-        for (firstSibling = this;
-             firstSibling->prevSibling != nullptr;
-             firstSibling = firstSibling->prevSibling) {}
-        newSibling->linkNext(firstSibling);
+        newSibling->linkNext(segmentStart);
+    } else {
+        newSibling->linkAcrossGap(segmentStart);
     }
 
     return nextSibling;
@@ -209,6 +383,13 @@ MemoryCell* MemoryCell::shiftBack(num n) {
     // if n is larger than the size of the loop, we can accomplish the same thing in less than n
     // calls to getPrev()
     num numOps = n % parent->value;
+    // walking a long way around a loop is slow, so this may switch it to a layout where we can jump
+    // straight to the destination
+    parent->recordShift(numOps);
+    if (parent->isIndexed()) {
+        ChildIndex& index = *parent->childIndex;
+        return parent->indexedChildAt(index.back(index.positionOf(this), numOps));
+    }
     MemoryCell* curr = this;
     for (num i = 0; i < numOps; i++) {
         curr = curr->getPrev();
@@ -219,6 +400,11 @@ MemoryCell* MemoryCell::shiftBack(num n) {
 MemoryCell* MemoryCell::shiftForward(num n) {
     // see MemoryCell::shiftBack(num n) for an explanation of how this works
     num numOps = n % parent->value;
+    parent->recordShift(numOps);
+    if (parent->isIndexed()) {
+        ChildIndex& index = *parent->childIndex;
+        return parent->indexedChildAt(index.forward(index.positionOf(this), numOps));
+    }
     MemoryCell* curr = this;
     for (num i = 0; i < numOps; i++) {
         curr = curr->getNext();
@@ -226,12 +412,30 @@ MemoryCell* MemoryCell::shiftForward(num n) {
     return curr;
 }
 
+MemoryCell* MemoryCell::ascend() {
+    MemoryCell* up = parent;
+    up->packChildren();
+    return up;
+}
+
 void MemoryCell::makeFirst() {
-    getParent()->firstChild = this;
+    if (parent->isIndexed()) {
+        parent->childIndex->setFirst(parent->childIndex->positionOf(this));
+    } else {
+        parent->firstChild = this;
+    }
 }
 
 MemoryCell* MemoryCell::insertBefore(num _value) {
     MemoryCell* newCell = new MemoryCell(_value);
+    if (parent->isIndexed()) {
+        newCell->parent = parent;
+        parent->childIndex->insert(parent->childIndex->positionOf(this), newCell);
+        parent->value++;
+        parent->numChildrenInstantiated++;
+        parent->recordEdit();
+        return newCell;
+    }
     MemoryCell* prevCell = getPrev();
     prevCell->linkNext(newCell);
     this->linkPrev(newCell);
@@ -242,15 +446,34 @@ MemoryCell* MemoryCell::insertBefore(num _value) {
 }
 
 MemoryCell* MemoryCell::insertAfter(num _value) {
+    // an index doesn't need the next cell to be instantiated to know where to put the new one
+    if (parent->isIndexed()) {
+        MemoryCell* newCell = new MemoryCell(_value);
+        newCell->parent = parent;
+        parent->childIndex->insert(parent->childIndex->positionOf(this) + 1, newCell);
+        parent->value++;
+        parent->numChildrenInstantiated++;
+        parent->recordEdit();
+        return newCell;
+    }
     MemoryCell* nextCell = getNext();
     MemoryCell* newCell = nextCell->insertBefore(_value);
     return newCell;
 }
 
 MemoryCell* MemoryCell::deleteBefore() {
-    MemoryCell* prevCell = getPrev();
-    MemoryCell* nextCell = getNext();
-    prevCell->linkNext(nextCell);
+    if (parent->isIndexed()) return deleteIndexed(false);
+    MemoryCell* prevCell = linkedPrev();
+    MemoryCell* nextCell = linkedNext();
+    // if the previous cell hasn't been instantiated, this cell can take its place instead of being
+    // destroyed just so that a new one can be allocated
+    if (prevCell == nullptr) return replaceSibling();
+    // the next cell isn't needed, so it's left uninstantiated if it is
+    if (nextCell == nullptr) {
+        prevCell->linkAcrossGap(nextSibling);
+    } else {
+        prevCell->linkNext(nextCell);
+    }
     parent->value--;
     parent->numChildrenInstantiated--;
     if (parent->firstChild == this)
@@ -260,9 +483,16 @@ MemoryCell* MemoryCell::deleteBefore() {
 }
 
 MemoryCell* MemoryCell::deleteAfter() {
-    MemoryCell* prevCell = getPrev();
-    MemoryCell* nextCell = getNext();
-    prevCell->linkNext(nextCell);
+    // see MemoryCell::deleteBefore() for an explanation of how this works
+    if (parent->isIndexed()) return deleteIndexed(true);
+    MemoryCell* prevCell = linkedPrev();
+    MemoryCell* nextCell = linkedNext();
+    if (nextCell == nullptr) return replaceSibling();
+    if (prevCell == nullptr) {
+        prevSibling->linkAcrossGap(nextCell);
+    } else {
+        prevCell->linkNext(nextCell);
+    }
     parent->value--;
     parent->numChildrenInstantiated--;
     if (parent->firstChild == this)
@@ -272,7 +502,12 @@ MemoryCell* MemoryCell::deleteAfter() {
 }
 
 void MemoryCell::insertChild(MemoryCell* newChild) {
-    if (value == 0) {
+    if (isShared()) unshare();
+    if (isPacked()) unpack();
+    if (isIndexed()) {
+        newChild->parent = this;
+        childIndex->insert(value, newChild);
+    } else if (value == 0) {
         this->firstChild = newChild;
         newChild->parent = this;
         newChild->linkNext(newChild);
@@ -284,17 +519,392 @@ void MemoryCell::insertChild(MemoryCell* newChild) {
     }
     value++;
     numChildrenInstantiated++;
+    if (isIndexed()) recordEdit();
+}
+
+void MemoryCell::share(const SharedTree& tree) {
+    setVal(tree.root().value);
+    shareNode(&tree.root());
+}
+
+void MemoryCell::setLeaves(std::vector<num>&& values) {
+    setVal(toNum(values.size()));
+    if (values.empty()) return;
+    setLayout(Layout::PACKED);
+    leaves = new LeafVector(std::move(values));
+    numChildrenInstantiated = value;
+}
+
+const std::vector<num>* MemoryCell::getLeaves() const {
+    const MemoryCell& source = isShared() ? *sharedSource : *this;
+    return source.isPacked() ? &source.leaves->values() : nullptr;
+}
+
+void MemoryCell::shareNode(const MemoryCell* source) {
+    reset();
+    value = source->value;
+    if (source->isShared()) source = source->sharedSource;
+    // there's nothing to share if source has no children
+    if (source->numChildrenInstantiated == 0) return;
+    SharedTree::of(source)->addRef();
+    setLayout(Layout::SHARED);
+    sharedSource = const_cast<MemoryCell*>(source);
+}
+
+void MemoryCell::unshare() {
+    const MemoryCell* source = sharedSource;
+    setLayout(Layout::LINKED);
+    firstChild = nullptr;
+    // copy only source's children, and leave them sharing their own children
+    copyChildren(*source, nullptr);
+    SharedTree::of(source)->release();
+}
+
+void MemoryCell::unpack() {
+    LeafVector* packed = leaves;
+    setLayout(Layout::LINKED);
+    // something needs these children to be cells, and probably will again
+    AccessStats newStats = getStats();
+    newStats.keepUnpacked = 1;
+    setStats(newStats);
+    // the loop is full, so the children simply link up in order and wrap around
+    const std::vector<num>& values = packed->values();
+    firstChild = new MemoryCell(values.front());
+    firstChild->parent = this;
+    MemoryCell* prevChild = firstChild;
+    for (std::size_t i = 1; i < values.size(); i++) {
+        MemoryCell* child = new MemoryCell(values[i]);
+        prevChild->linkNext(child);
+        prevChild = child;
+    }
+    prevChild->linkNext(firstChild);
+    delete packed;
+}
+
+MemoryCell* MemoryCell::copyOf(const MemoryCell& other, std::vector<PendingCopy>* pending) {
+    MemoryCell* copy = new MemoryCell(other.value);
+    if (pending == nullptr) {
+        copy->shareNode(&other);
+    } else if (other.numChildrenInstantiated != 0 || other.isShared()) {
+        pending->emplace_back(copy, &other);
+    }
+    return copy;
+}
+
+void MemoryCell::adoptChildren(const std::pair<num, MemoryCell*>* begin, const std::pair<num, MemoryCell*>* end, bool indexed) {
+    num numChildren = static_cast<num>(end - begin);
+    if (numChildren == 0) return;
+    numChildrenInstantiated = numChildren;
+    // the children may have come out of an index, where prevSibling was their slot
+    for (auto it = begin; it != end; it++) {
+        it->second->parent = this;
+        it->second->prevSibling = nullptr;
+        it->second->nextSibling = nullptr;
+        it->second->setGapBefore(false);
+        it->second->setGapAfter(false);
+    }
+
+    // The LINKED layout needs the children to be at offsets 0 through a, followed by value - b
+    // through value - 1. Find where the first part ends and check that the second part is right.
+    num numFront = 0;
+    while (numFront < numChildren && begin[numFront].first == numFront) numFront++;
+    for (num i = numFront; i < numChildren && !indexed; i++) {
+        if (begin[i].first != value - (numChildren - i)) indexed = true;
+    }
+    if (numFront == 0) indexed = true;
+
+    if (indexed) {
+        ChildIndex* index = new ChildIndex(value, numChildren);
+        for (auto it = begin; it != end; it++) index->set(it->first, it->second);
+        setLayout(Layout::INDEXED);
+        childIndex = index;
+        return;
+    }
+    firstChild = begin[0].second;
+    // link up the front part, then the back part, which leads into the front part
+    for (num i = 0; i + 1 < numChildren; i++) {
+        if (i + 1 != numFront) begin[i].second->linkNext(begin[i + 1].second);
+    }
+    if (numFront < numChildren) begin[numChildren - 1].second->linkNext(begin[0].second);
+    // the back part is empty if the loop is full, so then the front part wraps around to itself
+    MemoryCell* startCell = begin[numFront % numChildren].second;
+    MemoryCell* endCell = begin[numFront - 1].second;
+    if (isFull()) {
+        endCell->linkNext(startCell);
+    } else {
+        endCell->linkAcrossGap(startCell);
+    }
+}
+
+MemoryCell* MemoryCell::indexedChildAt(num pos) {
+    MemoryCell* child = childIndex->at(pos);
+    if (child != nullptr) return child;
+    child = new MemoryCell(0);
+    child->parent = this;
+    childIndex->set(pos, child);
+    numChildrenInstantiated++;
+    return child;
+}
+
+void MemoryCell::buildIndex() {
+    ChildIndex* index = new ChildIndex(value, numChildrenInstantiated);
+    // The instantiated children are a contiguous segment of the loop which includes the first
+    // child, so put the first child at position 0 and go forwards from it. If we cross the gap,
+    // the rest of the segment is behind the first child, at the end of the loop. We clear each
+    // child's sibling links as we go, since they aren't used in the INDEXED layout, and the index's
+    // slot goes where prevSibling was.
+    MemoryCell* curr = firstChild;
+    num pos = 0;
+    for (num i = 0; i < numChildrenInstantiated; i++) {
+        MemoryCell* next = curr->nextSibling;
+        bool isGapNext = curr->isGapAfter();
+        curr->nextSibling = nullptr;
+        curr->setGapBefore(false);
+        curr->setGapAfter(false);
+        index->set(pos, curr);
+        pos = isGapNext ? value - (numChildrenInstantiated - i - 1) : pos + 1;
+        curr = next;
+    }
+    setLayout(Layout::INDEXED);
+    childIndex = index;
+}
+
+template <typename Function>
+void MemoryCell::forEachChildCell(Function f) {
+    if (isIndexed()) {
+        ChildIndex& index = *childIndex;
+        num first = index.first();
+        index.forEach([first, &f](num pos, MemoryCell* child) { if (pos >= first) f(child); });
+        index.forEach([first, &f](num pos, MemoryCell* child) { if (pos < first) f(child); });
+        return;
+    }
+    // SHARED and PACKED children aren't cells
+    if (getLayout() != Layout::LINKED || firstChild == nullptr) return;
+    // if the loop isn't full, the rest of the segment, which is behind the first child, comes
+    // after crossing the gap
+    MemoryCell* curr = firstChild;
+    for (num i = 0; i < numChildrenInstantiated; i++) {
+        f(curr);
+        curr = curr->nextSibling;
+    }
+}
+
+MemoryCell* MemoryCell::moveTo(void* destination) {
+    MemoryCell* moved = ::new (destination) MemoryCell(value);
+    moved->numChildrenInstantiated = numChildrenInstantiated;
+    moved->setLayout(getLayout());
+    moved->setStats(getStats());
+    switch (getLayout()) {
+        case Layout::LINKED: moved->firstChild = firstChild; break;
+        case Layout::INDEXED: moved->childIndex = childIndex; break;
+        case Layout::SHARED: moved->sharedSource = sharedSource; break;
+        case Layout::PACKED: moved->leaves = leaves; break;
+    }
+    moved->parent = parent;
+
+    if (parent->isIndexed()) {
+        ChildIndex& index = *parent->childIndex;
+        index.set(index.positionOf(this), moved);
+    } else {
+        moved->prevSibling = prevSibling;
+        moved->nextSibling = nextSibling;
+        moved->setGapBefore(isGapBefore());
+        moved->setGapAfter(isGapAfter());
+        if (parent->firstChild == this) parent->firstChild = moved;
+        // a cell on its own in a loop (or segment) is its own sibling
+        if (prevSibling == this) {
+            moved->prevSibling = moved;
+            moved->nextSibling = moved;
+        } else {
+            prevSibling->nextSibling = moved;
+            nextSibling->prevSibling = moved;
+        }
+    }
+    moved->forEachChildCell([moved](MemoryCell* child) { child->parent = moved; });
+
+    setLayout(Layout::LINKED);
+    firstChild = nullptr;
+    return moved;
+}
+
+void MemoryCell::dropIndex() {
+    ChildIndex* index = childIndex;
+    num first = index->first();
+    if (index->at(first) == nullptr) return;
+    // count the instantiated children from the first one forwards, and then from just before it
+    // backwards, stopping at the first gap in each direction
+    num numFront = 1;
+    while (numFront < numChildrenInstantiated && index->at(index->forward(first, numFront)) != nullptr) {
+        numFront++;
+    }
+    num numBack = 0;
+    while (numFront + numBack < numChildrenInstantiated && index->at(index->back(first, numBack + 1)) != nullptr) {
+        numBack++;
+    }
+    if (numFront + numBack < numChildrenInstantiated) return;
+
+    std::vector<std::pair<num, MemoryCell*>> children;
+    children.reserve(numChildrenInstantiated);
+    for (num i = 0; i < numFront; i++) children.emplace_back(i, index->at(index->forward(first, i)));
+    for (num i = numBack; i > 0; i--) children.emplace_back(value - i, index->at(index->back(first, i)));
+    delete index;
+    setLayout(Layout::LINKED);
+    firstChild = nullptr;
+    numChildrenInstantiated = 0;
+    AccessStats newStats = getStats();
+    newStats.wasIndexed = 1;
+    setStats(newStats);
+    adoptChildren(children.data(), children.data() + children.size(), false);
+}
+
+void MemoryCell::packChildren() {
+    if (getLayout() != Layout::LINKED || getStats().keepUnpacked || value < PACK_MIN_SIZE || !isFull()) return;
+    std::vector<num> values;
+    values.reserve(value);
+    MemoryCell* curr = firstChild;
+    do {
+        if (curr->getLayout() != Layout::LINKED || curr->numChildrenInstantiated != 0) {
+            // this loop isn't made of leaves, and checking again every time would be a waste
+            AccessStats newStats = getStats();
+            newStats.keepUnpacked = 1;
+            setStats(newStats);
+            return;
+        }
+        values.push_back(curr->value);
+        curr = curr->nextSibling;
+    } while (curr != firstChild);
+    for (num i = 0; i < value; i++) {
+        MemoryCell* next = curr->nextSibling;
+        delete curr;
+        curr = next;
+    }
+    setLayout(Layout::PACKED);
+    leaves = new LeafVector(std::move(values));
+}
+
+void MemoryCell::recordShift(num numOps) {
+    if (numOps < INDEX_SHIFT_THRESHOLD) return;
+    // the index is paying for itself
+    AccessStats newStats = getStats();
+    if (isIndexed()) {
+        newStats.count = 0;
+        setStats(newStats);
+        return;
+    }
+    if (newStats.count < MAX_STATS_COUNT) newStats.count++;
+    // a loop which was taken out of an index has to show that it needs one again
+    if (!newStats.wasIndexed || newStats.count >= REINDEX_SHIFTS) {
+        newStats.count = 0;
+        setStats(newStats);
+        buildIndex();
+        return;
+    }
+    setStats(newStats);
+}
+
+void MemoryCell::recordEdit() {
+    AccessStats newStats = getStats();
+    if (newStats.count < MAX_STATS_COUNT) newStats.count++;
+    if (newStats.count >= UNINDEX_EDITS) {
+        newStats.count = 0;
+        setStats(newStats);
+        dropIndex();
+        return;
+    }
+    setStats(newStats);
+}
+
+MemoryCell* MemoryCell::replaceSibling() {
+    setVal(0);
+    parent->value--;
+    // the parent has one fewer child but just as many instantiated, so its loop may now be full,
+    // in which case the gap next to this cell is gone and the ends of the segment are neighbours
+    if (parent->isFull()) {
+        if (isGapAfter()) {
+            linkNext(nextSibling);
+        } else {
+            prevSibling->linkNext(this);
+        }
+    }
+    return this;
+}
+
+MemoryCell* MemoryCell::deleteIndexed(bool forwards) {
+    MemoryCell* parentCell = parent;
+    ChildIndex& index = *parentCell->childIndex;
+    num pos = index.positionOf(this);
+    num neighborPos = forwards ? index.forward(pos, 1) : index.back(pos, 1);
+    MemoryCell* neighbor = index.at(neighborPos);
+    parent->value--;
+    if (neighbor == nullptr) {
+        // take the uninstantiated neighbor's place, like replaceSibling() does
+        bool wasFirst = index.first() == pos || index.first() == neighborPos;
+        setVal(0);
+        index.erase(neighborPos);
+        if (wasFirst) index.setFirst(index.positionOf(this));
+        parentCell->recordEdit();
+        return this;
+    }
+    bool wasFirst = index.first() == pos;
+    index.erase(pos);
+    if (wasFirst) index.setFirst(index.positionOf(neighbor));
+    parentCell->numChildrenInstantiated--;
+    delete this;
+    parentCell->recordEdit();
+    return neighbor;
 }
 
 inline void MemoryCell::linkNext(MemoryCell* next) {
     this->nextSibling = next;
     next->prevSibling = this;
     next->parent = this->parent;
+    this->setGapAfter(false);
+    next->setGapBefore(false);
 }
 
 inline void MemoryCell::linkPrev(MemoryCell* prev) {
     this->prevSibling = prev;
     prev->nextSibling = this;
     prev->parent = this->parent;
+    this->setGapBefore(false);
+    prev->setGapAfter(false);
+}
+
+inline void MemoryCell::linkAcrossGap(MemoryCell* start) {
+    this->nextSibling = start;
+    start->prevSibling = this;
+    this->setGapAfter(true);
+    start->setGapBefore(true);
+}
+
+
+void* MemoryCell::operator new(std::size_t size) {
+    // this should only happen if someone derives from MemoryCell, but just in case
+    if (size != sizeof(MemoryCell)) return ::operator new(size);
+    return pool().allocate();
+}
+
+void MemoryCell::operator delete(void* ptr, std::size_t size) {
+    if (size != sizeof(MemoryCell)) {
+        ::operator delete(ptr);
+        return;
+    }
+    pool().deallocate(ptr);
 }
 
+SharedTree* SharedTree::create(MemoryCell&& root) {
+    SharedTree* tree = new SharedTree();
+    tree->root_ = std::move(root);
+    return tree;
+}
+
+SharedTree* SharedTree::of(const MemoryCell* node) {
+    while (node->parent != nullptr) node = node->parent;
+    // root_ is the first member of a SharedTree, so they have the same address
+    return static_cast<SharedTree*>(const_cast<void*>(static_cast<const void*>(node)));
+}
+
+void SharedTree::release() {
+    numRefs_--;
+    if (numRefs_ == 0) delete this;
+}
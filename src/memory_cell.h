@@ -2,22 +2,256 @@
 
 #pragma once
 
+#include <bit>
+#include <cstddef>
+#include <cstdint>
 #include <utility>
 #include <string>
+#include <vector>
 #include "definitions.h"
+#include "cell_pool.h"
 
 namespace spherehorn {
 
-class MemoryCell {
+class MemoryCell;
+class ChildIndex;
+class LeafVector;
+class SharedTree;
+
+#ifdef SPHEREHORN_COMPACT_CELLS
+// In the compact layout, cells link to each other with 32-bit references into the cell pool's
+// region rather than with full pointers. A CellLink otherwise behaves like a MemoryCell*.
+class CellLink {
+private:
+    std::uint32_t ref_;
+public:
+    CellLink() = default;
+    constexpr CellLink(std::nullptr_t) : ref_(0) {}
+    inline CellLink(MemoryCell* cell);
+    inline operator MemoryCell*() const;
+    MemoryCell* operator ->() const { return *this; }
+    MemoryCell& operator *() const { return *static_cast<MemoryCell*>(*this); }
+};
+
+// Likewise, a 32-bit reference to one of the other objects a cell can own (a ChildIndex or a
+// LeafVector), which otherwise behaves like a T*. These aren't allocated from the cell pool, so each
+// one is given an entry in a table when it's constructed (see add()).
+template <typename T>
+class TableLink {
+private:
+    std::uint32_t ref_;
+public:
+    TableLink() = default;
+    constexpr TableLink(std::nullptr_t) : ref_(0) {}
+    TableLink(T* object) : ref_(object == nullptr ? 0 : object->id()) {}
+    operator T*() const { return ref_ == 0 ? nullptr : table()[ref_ - 1]; }
+    T* operator ->() const { return *this; }
+    T& operator *() const { return *static_cast<T*>(*this); }
+    static std::vector<T*>& table() {
+        static std::vector<T*> objects;
+        return objects;
+    }
+    // Give an object an entry in the table, returning its id, and take it away again
+    static std::uint32_t add(T* object) {
+        std::vector<std::uint32_t>& free = freeIds();
+        if (free.empty()) {
+            table().push_back(object);
+            return static_cast<std::uint32_t>(table().size());
+        }
+        std::uint32_t id = free.back();
+        free.pop_back();
+        table()[id - 1] = object;
+        return id;
+    }
+    static void remove(std::uint32_t id) {
+        table()[id - 1] = nullptr;
+        freeIds().push_back(id);
+    }
+private:
+    // entries of table() which have been freed and can be reused
+    static std::vector<std::uint32_t>& freeIds() {
+        static std::vector<std::uint32_t> ids;
+        return ids;
+    }
+};
+using IndexLink = TableLink<ChildIndex>;
+using LeafLink = TableLink<LeafVector>;
+#else
+using CellLink = MemoryCell*;
+using IndexLink = ChildIndex*;
+using LeafLink = LeafVector*;
+#endif
+
+// A cell keeps some of its own state in bits of its links which would otherwise always be 0 (see
+// MemoryCell::getLayout() and so on). Pointers have their low 3 bits to spare, since everything a
+// cell links to is 8-byte aligned, and compact references have their high 3 bits to spare, since
+// they never get that big (see CellPool::EXTERNAL_BIT). A TaggedLink otherwise behaves like the Link
+// to a T that it holds, and pointing it somewhere else leaves its tag alone.
+template <typename T, typename Link>
+class TaggedLink {
+public:
+#ifdef SPHEREHORN_COMPACT_CELLS
+    using Bits = std::uint32_t;
+    static constexpr unsigned TAG_SHIFT = 29;
+#else
+    using Bits = std::uintptr_t;
+    static constexpr unsigned TAG_SHIFT = 0;
+#endif
+    static constexpr Bits TAG_MASK = Bits(7) << TAG_SHIFT;
+private:
+    Bits bits_;
+public:
+    constexpr TaggedLink(std::nullptr_t) : bits_(0) {}
+    // the tag belongs to the cell holding the link, so copies only get the link itself
+    TaggedLink(const TaggedLink& other) : bits_(other.bits_ & ~TAG_MASK) {}
+    TaggedLink& operator =(const TaggedLink& other) { return *this = static_cast<T*>(other); }
+    TaggedLink& operator =(T* object) {
+        Link link = object;
+        bits_ = std::bit_cast<Bits>(link) | (bits_ & TAG_MASK);
+        return *this;
+    }
+    operator T*() const { return std::bit_cast<Link>(bits_ & ~TAG_MASK); }
+    T* operator ->() const { return *this; }
+    T& operator *() const { return *static_cast<T*>(*this); }
+    unsigned tag() const { return (bits_ & TAG_MASK) >> TAG_SHIFT; }
+    void setTag(unsigned newTag) {
+        Bits tagBits = newTag;
+        bits_ = (bits_ & ~TAG_MASK) | tagBits << TAG_SHIFT;
+    }
+};
+
+// The slot that an INDEXED child keeps in place of its prevSibling (see MemoryCell), which goes in
+// the rest of the link's bits and leaves its tag alone
+class TaggedSlot {
 private:
+    using Link = TaggedLink<MemoryCell, CellLink>;
+#ifdef SPHEREHORN_COMPACT_CELLS
+    static constexpr unsigned SLOT_SHIFT = 0;
+#else
+    static_assert(sizeof(std::uintptr_t) >= 8, "a slot and a tag don't fit in a pointer");
+    static constexpr unsigned SLOT_SHIFT = 3;
+#endif
+    Link::Bits bits_;
+public:
+    static constexpr std::uint32_t MAX_SLOT = ~Link::TAG_MASK >> SLOT_SHIFT & UINT32_MAX;
+    TaggedSlot& operator =(std::uint32_t slot) {
+        Link::Bits slotBits = slot;
+        bits_ = slotBits << SLOT_SHIFT | (bits_ & Link::TAG_MASK);
+        return *this;
+    }
+    operator std::uint32_t() const { return (bits_ & ~Link::TAG_MASK) >> SLOT_SHIFT; }
+};
+
+// Cells are pointer-aligned even in the compact layout, so that whatever the width of num they fill
+// their pool slots exactly
+class alignas(alignof(void*)) MemoryCell {
+private:
+    // How a cell keeps track of its children:
+    // - LINKED: the instantiated children are a contiguous segment of the loop, linked together
+    //   through their prevSibling and nextSibling, and firstChild points to the first one. If the
+    //   loop isn't full, the two ends of the segment are linked to each other across the
+    //   uninstantiated children, and their gap links say so. Either way, following nextSibling from
+    //   any child goes through every instantiated child once before coming back round.
+    // - INDEXED: childIndex holds every child in loop order (see child_index.h). The children's
+    //   sibling links aren't used.
+    // - SHARED: the children are those of sharedSource, a cell in a SharedTree, and nothing has been
+    //   instantiated yet. They're copied the first time something looks at them.
+    // - PACKED: every child is instantiated and has no instantiated children of its own, so leaves
+    //   just holds their values, in loop order starting from the first child. They're turned into
+    //   cells the first time something needs to point at one of them.
+    enum struct Layout : std::uint8_t {
+        LINKED,
+        INDEXED,
+        SHARED,
+        PACKED,
+    };
+    // What the program has been doing with a cell's children, which decides which layout they're
+    // kept in
+    struct AccessStats {
+        // LINKED: the number of long shifts since the children were last taken out of an index.
+        // INDEXED: the number of inserts and deletes since the last long shift.
+        std::uint8_t count : 5 = 0;
+        // the children have been taken out of an index before, so they need more long shifts to be
+        // put back into one
+        std::uint8_t wasIndexed : 1 = 0;
+        // the children have been unpacked (or couldn't be packed), so they won't be packed again
+        std::uint8_t keepUnpacked : 1 = 0;
+    };
+
     num value = 0;
     num numChildrenInstantiated = 0;
-    MemoryCell* firstChild = nullptr;
-    MemoryCell* prevSibling = nullptr;
-    MemoryCell* nextSibling = nullptr;
-    MemoryCell* parent = nullptr;
+    // The layout, stats and gap links are kept in the tags of these links (see getLayout() and so
+    // on), so they don't make cells any bigger
+    union {
+        TaggedLink<MemoryCell, CellLink> firstChild = nullptr;
+        TaggedLink<ChildIndex, IndexLink> childIndex;
+        TaggedLink<MemoryCell, CellLink> sharedSource;
+        TaggedLink<LeafVector, LeafLink> leaves;
+    };
+    // INDEXED children don't use their sibling links, so they keep their position in the parent's
+    // childIndex in place of prevSibling. Check the parent's layout before reading either.
+    union {
+        TaggedLink<MemoryCell, CellLink> prevSibling = nullptr;
+        TaggedSlot slot;
+    };
+    TaggedLink<MemoryCell, CellLink> nextSibling = nullptr;
+    TaggedLink<MemoryCell, CellLink> parent = nullptr;
 
+    // Shifting at least this many places at once makes a loop switch to the INDEXED layout (or
+    // count towards switching, if it's been INDEXED before)
+    static constexpr num INDEX_SHIFT_THRESHOLD = 8;
+    // A loop which has been taken out of an index needs this many long shifts to go back into one
+    static constexpr std::uint8_t REINDEX_SHIFTS = 4;
+    // An INDEXED loop which has this many inserts and deletes without a long shift in between goes
+    // back to being LINKED, where they don't have to move the other children around
+    static constexpr std::uint8_t UNINDEX_EDITS = 16;
+    // The smallest full loop of leaves that's worth packing when the program leaves it
+    static constexpr num PACK_MIN_SIZE = 16;
+    static constexpr std::uint8_t MAX_STATS_COUNT = 31;
+    // The most cells that reclaimSome() destroys at once
+    static constexpr std::size_t RECLAIM_SLICE = 64;
+
+    // Cells whose children are waiting to be destroyed, if reclamation is deferred
+    static std::vector<MemoryCell*> garbage;
+    static bool isReclamationDeferred;
+    // Automatic compaction isn't worth it for fewer cells than this
+    static constexpr std::size_t COMPACT_MIN_CELLS = 4096;
+    static bool isCompactionAutomatic;
+    // the pool's numRecycled() just after the last compaction
+    static std::size_t recycledAtCompaction;
+
+    // The tags hold:
+    // - firstChild: the layout in bits 0-1, and stats.keepUnpacked in bit 2
+    // - prevSibling: whether it's a gap link in bit 0, and stats.wasIndexed in bit 1
+    // - nextSibling: whether it's a gap link in bit 0, and the low 2 bits of stats.count in bits 1-2
+    // - parent: the high 3 bits of stats.count
+    Layout getLayout() const { return static_cast<Layout>(firstChild.tag() & 3u); }
+    void setLayout(Layout newLayout) {
+        firstChild.setTag((firstChild.tag() & ~3u) | static_cast<unsigned>(newLayout));
+    }
+    AccessStats getStats() const {
+        AccessStats result;
+        result.count = static_cast<std::uint8_t>((nextSibling.tag() >> 1) | (parent.tag() << 2));
+        result.wasIndexed = static_cast<std::uint8_t>(prevSibling.tag() >> 1);
+        result.keepUnpacked = static_cast<std::uint8_t>(firstChild.tag() >> 2);
+        return result;
+    }
+    void setStats(AccessStats newStats) {
+        firstChild.setTag((firstChild.tag() & 3u) | unsigned(newStats.keepUnpacked) << 2);
+        prevSibling.setTag((prevSibling.tag() & 1u) | unsigned(newStats.wasIndexed) << 1);
+        nextSibling.setTag((nextSibling.tag() & 1u) | (unsigned(newStats.count) & 3u) << 1);
+        parent.setTag(unsigned(newStats.count) >> 2);
+    }
+    // Whether this cell's prevSibling/nextSibling goes across the uninstantiated children of its
+    // parent's loop, rather than to the neighbouring child
+    bool isGapBefore() const { return prevSibling.tag() & 1u; }
+    bool isGapAfter() const { return nextSibling.tag() & 1u; }
+    void setGapBefore(bool isGap) { prevSibling.setTag((prevSibling.tag() & ~1u) | unsigned(isGap)); }
+    void setGapAfter(bool isGap) { nextSibling.setTag((nextSibling.tag() & ~1u) | unsigned(isGap)); }
     constexpr bool isFull() const { return numChildrenInstantiated == value; }
+    bool isIndexed() const { return getLayout() == Layout::INDEXED; }
+    bool isShared() const { return getLayout() == Layout::SHARED; }
+    bool isPacked() const { return getLayout() == Layout::PACKED; }
 
 public:
     MemoryCell(num _value = 0) : value(_value) {}
@@ -31,12 +265,28 @@ public:
     MemoryCell(MemoryCell&& other) { *this = std::move(other); } // move constructor can simply use =
     ~MemoryCell();
     constexpr num getVal() const { return value; }
+    // Set this cell's value, destroying its children (or handing them to the reclaimer, if
+    // reclamation is deferred)
     void setVal(num _value);
+    // Destroy this cell's children
     void reset();
+    // Make this cell a copy of tree's root, without copying any of its children until they're needed
+    void share(const SharedTree& tree);
+    // Give this cell one child for each of values, with that value, and set its own value to match
+    // (so there can be at most num(-1) of them). The children are stored PACKED until something
+    // needs one of them to be a cell.
+    void setLeaves(std::vector<num>&& values);
+    // If this cell's children are PACKED (possibly in a tree it shares them with), return their
+    // values. Otherwise return null.
+    const std::vector<num>* getLeaves() const;
     MemoryCell* getChild();
     MemoryCell* getPrev();
     MemoryCell* getNext();
-    constexpr MemoryCell* getParent() const { return parent; }
+    MemoryCell* getParent() const { return parent; }
+    // Return this cell's parent, for when the program is moving up to it. Nothing can point into
+    // the parent's children after that, so this may switch them to a more compact layout (which
+    // destroys this cell).
+    MemoryCell* ascend();
     MemoryCell* shiftBack(num n);
     MemoryCell* shiftForward(num n);
     void makeFirst();
@@ -46,18 +296,173 @@ public:
     MemoryCell* insertAfter(num _value = 0);
     // Destroy this memory cell and return a pointer to the one just before/after it. The caller
     // must make sure that this cell has at least one sibling (i.e. the parent's value is >= 2).
+    // Neither function instantiates any other sibling; if the one being returned wasn't
+    // instantiated, this cell is reused to stand in for it, so nothing is allocated.
     MemoryCell* deleteBefore();
     MemoryCell* deleteAfter();
     // Insert child as the last child of this memory cell
     void insertChild(MemoryCell* child);
     // Recursively make copies of all of other's children and set them as children of this
     void copyChildren(MemoryCell& other);
-    constexpr bool isTop() const { return parent == nullptr; }
+    bool isTop() const { return parent == nullptr; }
+    // Every heap-allocated memory cell lives in a shared slab pool rather than going through the
+    // system allocator individually
+    static void* operator new(std::size_t size);
+    static void operator delete(void* ptr, std::size_t size);
+    // If deferred is true, setVal() hands the children it discards to a reclaimer instead of
+    // destroying them immediately, so that clearing a large tree takes constant time. The reclaimer
+    // then destroys them a slice at a time whenever reclaimSome() is called.
+    static void setDeferredReclamation(bool deferred) { isReclamationDeferred = deferred; }
+    static bool hasGarbage() { return !garbage.empty(); }
+    // Destroy up to RECLAIM_SLICE of the cells waiting to be reclaimed
+    static void reclaimSome();
+    // Destroy every cell waiting to be reclaimed
+    static void reclaimAll();
+    // Move every cell below root into slots which are laid out in the order the tree is walked: each
+    // loop's children are next to each other in order from the first one, and are followed by their
+    // own children's loops in depth first order. If tracked points to one of the cells which are
+    // moved, it's updated to point to the cell's new place.
+    static void compact(MemoryCell& root, MemoryCell*& tracked);
+    // If automatic is true, needsCompaction() says when the live cells have probably become
+    // scattered, i.e. when at least as many cells as are live have been allocated out of order
+    // since the last compaction
+    static void setAutoCompaction(bool automatic) { isCompactionAutomatic = automatic; }
+    // This is checked between every two instructions, so it's inline
+    static bool needsCompaction() {
+        if (!isCompactionAutomatic) return false;
+        const CellPool& cellPool = pool();
+        return cellPool.numLive() >= COMPACT_MIN_CELLS &&
+               cellPool.numRecycled() - recycledAtCompaction >= cellPool.numLive();
+    }
+    static CellPool& pool() {
+#ifdef SPHEREHORN_COMPACT_CELLS
+        static CellPool cellPool (sizeof(MemoryCell), CellPool::MAX_REGION_SLOTS);
+#else
+        static CellPool cellPool (sizeof(MemoryCell));
+#endif
+        return cellPool;
+    }
 
 private:
+    friend class ChildIndex;
+#ifdef SPHEREHORN_COMPACT_CELLS
+    friend class CellLink;
+    // convert between cells and the references that CellLinks store
+    static std::uint32_t refOf(const MemoryCell* cell) {
+        if (cell == nullptr) return 0;
+        CellPool& cellPool = pool();
+        if (!cellPool.inRegion(cell)) return cellPool.externalRef(cell);
+        const std::byte* bytePtr = static_cast<const std::byte*>(static_cast<const void*>(cell));
+        return static_cast<std::uint32_t>(static_cast<std::size_t>(bytePtr - cellPool.regionBase()) / sizeof(MemoryCell));
+    }
+    static MemoryCell* cellAt(std::uint32_t ref) {
+        if (ref == 0) return nullptr;
+        CellPool& cellPool = pool();
+        const void* cell = CellPool::isExternalRef(ref) ?
+                           cellPool.externalAt(ref) :
+                           cellPool.regionBase() + std::size_t(ref) * sizeof(MemoryCell);
+        return static_cast<MemoryCell*>(const_cast<void*>(cell));
+    }
+#endif
+
     // link the memory cell as this's next/previous sibling
     inline void linkNext(MemoryCell* next);
     inline void linkPrev(MemoryCell* prev);
+    // link this cell, the end of its parent's segment of instantiated children, to start, the other
+    // end, across the uninstantiated children
+    inline void linkAcrossGap(MemoryCell* start);
+    // return the next/previous sibling, or null if it hasn't been instantiated
+    MemoryCell* linkedNext() const {
+        if (isGapAfter()) return nullptr;
+        return nextSibling;
+    }
+    MemoryCell* linkedPrev() const {
+        if (isGapBefore()) return nullptr;
+        return prevSibling;
+    }
+    // For INDEXED cells: return the child at the given position of childIndex, instantiating it if
+    // necessary
+    MemoryCell* indexedChildAt(num pos);
+    // Switch this cell's children from the LINKED to the INDEXED layout
+    void buildIndex();
+    // Call f(child) for each of this cell's instantiated children, in order from the first child
+    template <typename Function>
+    void forEachChildCell(Function f);
+    // Construct a copy of this cell in destination, with every link to this cell (from its parent,
+    // siblings and children) pointed at the copy instead, and leave this cell with no children so
+    // that it can be destroyed without affecting anything
+    MemoryCell* moveTo(void* destination);
+    // Switch this cell's children from the INDEXED back to the LINKED layout, if the instantiated
+    // ones are a contiguous segment around the first child
+    void dropIndex();
+    // Switch this cell's children from the LINKED to the PACKED layout, if they're a full loop of
+    // cells without children of their own
+    void packChildren();
+    // Update the access statistics after a shift of numOps places among this cell's children, or an
+    // insert or delete, switching layouts if they call for it
+    void recordShift(num numOps);
+    void recordEdit();
+    // For children of LINKED cells whose sibling on one side isn't instantiated: remove this cell
+    // from the loop and make it stand in for that sibling, by resetting it to 0
+    MemoryCell* replaceSibling();
+    // For children of INDEXED cells: remove this cell from its parent's index and return the child
+    // just after/before it, reusing this cell for that child if it isn't instantiated
+    MemoryCell* deleteIndexed(bool forwards);
+    // Move all of this cell's instantiated children onto released (without destroying them), leaving
+    // it with none
+    void releaseChildren(std::vector<MemoryCell*>& released);
+    // Hand this cell's children to the reclaimer, leaving it with none
+    void discardChildren();
+    // a copied cell, and the original whose children still need to be copied into it
+    using PendingCopy = std::pair<MemoryCell*, const MemoryCell*>;
+    // Give this cell, which must have been reset first, copies of other's children. Any of those
+    // which have children of their own are pushed onto pending, so that the caller can copy their
+    // children in turn. If pending is null, they share their children with other's instead (see
+    // shareNode()).
+    void copyChildren(const MemoryCell& other, std::vector<PendingCopy>* pending);
+    static MemoryCell* copyOf(const MemoryCell& other, std::vector<PendingCopy>* pending);
+    // Make this cell a SHARED copy of source, which must be in a SharedTree
+    void shareNode(const MemoryCell* source);
+    // Turn a SHARED cell back into a LINKED (or PACKED) one by copying the source's children
+    void unshare();
+    // Turn a PACKED cell into a LINKED one by instantiating each of its children as a cell
+    void unpack();
+    // Give this cell, which mustn't have any children yet, the given children. Each is paired with
+    // its offset from the first child, and they must be in order of offset. They're put into an
+    // index if indexed is true or if they aren't a contiguous segment around the first child.
+    void adoptChildren(const std::pair<num, MemoryCell*>* begin, const std::pair<num, MemoryCell*>* end, bool indexed);
+
+    friend class SharedTree;
+    friend class MemoryImage;
+    friend class LiteralPool;
 };
 
+// An immutable tree of memory cells, which any number of cells can use as their own children
+// without copying them. It's reference counted, and destroys itself when the last reference goes.
+class SharedTree {
+private:
+    // this must be the first member, so that SharedTree::of() can find the tree from its root
+    MemoryCell root_;
+    std::size_t numRefs_ = 1;
+
+    SharedTree() {}
+    ~SharedTree() {}
+
+public:
+    SharedTree(const SharedTree&) = delete;
+    SharedTree& operator =(const SharedTree&) = delete;
+    // Create a tree from root, holding a single reference to it
+    static SharedTree* create(MemoryCell&& root);
+    // Return the tree that a cell is part of
+    static SharedTree* of(const MemoryCell* node);
+    constexpr const MemoryCell& root() const { return root_; }
+    void addRef() { numRefs_++; }
+    void release();
+};
+
+#ifdef SPHEREHORN_COMPACT_CELLS
+inline CellLink::CellLink(MemoryCell* cell) : ref_(MemoryCell::refOf(cell)) {}
+inline CellLink::operator MemoryCell*() const { return MemoryCell::cellAt(ref_); }
+#endif
+
 }
@@ -0,0 +1,279 @@
+// memory_image.cpp
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "definitions.h"
+#include "memory_cell.h"
+#include "child_index.h"
+#include "memory_image.h"
+using namespace spherehorn;
+
+
+void MemoryImage::write(std::ostream& out, const MemoryCell& root, const MemoryCell* marked) {
+    // write the path to the marked cell, which we find by working upwards from it
+    out.put(marked == nullptr ? 0 : 1);
+    if (marked != nullptr) {
+        std::vector<num> path;
+        for (const MemoryCell* curr = marked; curr != &root; curr = curr->parent) {
+            if (curr->parent == nullptr) throw std::logic_error("marked cell is not part of the memory tree");
+            path.push_back(offsetOf(*curr));
+        }
+        writeNum(out, path.size());
+        for (auto it = path.rbegin(); it != path.rend(); it++) writeNum(out, *it);
+    }
+
+    // Write the tree in preorder. The stack holds the cells which still need to be written, along
+    // with the number of uninstantiated cells before each one; a cell's children are pushed in
+    // reverse so that they come off the stack in order.
+    std::vector<std::pair<num, const MemoryCell*>> stack;
+    stack.emplace_back(0, &root);
+    while (!stack.empty()) {
+        auto [gap, cell] = stack.back();
+        stack.pop_back();
+        if (cell != &root) writeNum(out, gap);
+        writeNum(out, cell->value);
+
+        if (const std::vector<num>* leaves = cell->getLeaves()) {
+            writeNum(out, (leaves->size() << 2) | HEADER_PACKED);
+            for (num leaf : *leaves) writeNum(out, leaf);
+            continue;
+        }
+        std::size_t childrenStart = stack.size();
+        std::uint64_t nextOffset = 0;
+        forEachChild(*cell, [&stack, &nextOffset](num offset, const MemoryCell* child) {
+            stack.emplace_back(toNum(offset - nextOffset), child);
+            nextOffset = std::uint64_t{offset} + 1;
+        });
+        const MemoryCell& source = cell->isShared() ? *cell->sharedSource : *cell;
+        writeNum(out, ((stack.size() - childrenStart) << 2) | (source.isIndexed() ? HEADER_INDEXED : 0));
+        std::reverse(stack.begin() + static_cast<std::ptrdiff_t>(childrenStart), stack.end());
+    }
+}
+
+void MemoryImage::writeLiteral(std::ostream& out, const MemoryCell& root, const MemoryCell* marked) {
+    // Each line is built up on its own and written out whole, which is much faster than writing
+    // each token to out separately
+    std::string line;
+    bool isAfterOpen = false;
+    auto endLine = [&out, &line]() {
+        line.push_back('\n');
+        out.write(line.data(), static_cast<std::streamsize>(line.size()));
+        line.clear();
+    };
+    // Write a token, separated from the last one by a space (or a new line, if this one's getting
+    // long) unless it comes just inside a bracket
+    auto writeToken = [&line, &isAfterOpen, &endLine](const char* start, std::size_t length) {
+        if (!line.empty() && line.size() + length >= LITERAL_LINE_LENGTH) {
+            endLine();
+        } else if (!line.empty() && !isAfterOpen && *start != ')') {
+            line.push_back(' ');
+        }
+        line.append(start, length);
+        isAfterOpen = *start == '(';
+    };
+    auto writeValue = [&writeToken](std::uint64_t value) {
+        char buffer[24];
+        char* end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+        writeToken(buffer, static_cast<std::size_t>(end - buffer));
+    };
+
+    // The stack holds the cells which still need to be written, along with the number of
+    // uninstantiated cells (i.e. zeros) before each one. A null cell stands for the end of a loop,
+    // which is written as its remaining zeros and a closing bracket.
+    std::vector<std::pair<std::uint64_t, const MemoryCell*>> stack;
+    stack.emplace_back(0, &root);
+    while (!stack.empty()) {
+        auto [gap, cell] = stack.back();
+        stack.pop_back();
+        for (std::uint64_t i = 0; i < gap; i++) writeValue(0);
+        if (cell == nullptr) {
+            writeToken(")", 1);
+            continue;
+        }
+        if (cell == marked) {
+            if (!line.empty()) endLine();
+            out << "# memory pointer\n";
+        }
+
+        const MemoryCell& source = cell->isShared() ? *cell->sharedSource : *cell;
+        if (source.numChildrenInstantiated == 0) {
+            writeValue(cell->value);
+            continue;
+        }
+        writeToken("(", 1);
+        if (const std::vector<num>* leaves = source.getLeaves()) {
+            for (num leaf : *leaves) writeValue(leaf);
+            writeToken(")", 1);
+            continue;
+        }
+        std::size_t childrenStart = stack.size();
+        std::uint64_t nextOffset = 0;
+        forEachChild(*cell, [&stack, &nextOffset](num offset, const MemoryCell* child) {
+            stack.emplace_back(offset - nextOffset, child);
+            nextOffset = std::uint64_t{offset} + 1;
+        });
+        stack.emplace_back(cell->value - nextOffset, nullptr);
+        std::reverse(stack.begin() + static_cast<std::ptrdiff_t>(childrenStart), stack.end());
+    }
+    endLine();
+}
+
+MemoryCell* MemoryImage::read(std::istream& in, MemoryCell*& marked) {
+    marked = nullptr;
+    auto readValue = [&in]() {
+        std::uint64_t value = readNum(in);
+        if (value > num(-1)) throw std::runtime_error("memory image contains a value which is too large");
+        return toNum(value);
+    };
+
+    int hasMarked = in.get();
+    if (hasMarked != 0 && hasMarked != 1) throw std::runtime_error("memory image is malformed");
+    std::vector<num> path;
+    if (hasMarked == 1) {
+        std::uint64_t pathLength = readNum(in);
+        for (std::uint64_t i = 0; i < pathLength; i++) path.push_back(readValue());
+    }
+
+    // A cell whose children are still being read. Its children go on the children stack as they're
+    // created, and are handed over to it once they've all been read.
+    struct Frame {
+        MemoryCell* cell;
+        std::uint64_t numRemaining;
+        std::uint64_t nextOffset;
+        std::size_t childrenStart;
+        bool isIndexed;
+        bool isOnPath;
+    };
+    std::vector<Frame> frames;
+    std::vector<std::pair<num, MemoryCell*>> children;
+
+    // Read a cell's header, and its children too if they're PACKED. Otherwise return the number of
+    // children to read.
+    auto readChildren = [&in, &readValue](MemoryCell* cell, std::uint64_t& header) {
+        header = readNum(in);
+        std::uint64_t numChildren = header >> 2;
+        if (numChildren > cell->value) throw std::runtime_error("memory image is malformed");
+        if ((header & HEADER_PACKED) == 0) return numChildren;
+        if (numChildren != cell->value) throw std::runtime_error("memory image is malformed");
+        std::vector<num> values;
+        for (std::uint64_t i = 0; i < numChildren; i++) values.push_back(readValue());
+        cell->setLeaves(std::move(values));
+        return std::uint64_t(0);
+    };
+
+    MemoryCell* root = new MemoryCell(0);
+    try {
+        root->value = readValue();
+        std::uint64_t header = 0;
+        std::uint64_t numChildren = readChildren(root, header);
+        if (hasMarked == 1 && path.empty()) marked = root;
+        frames.push_back({root, numChildren, 0, 0, (header & HEADER_INDEXED) != 0, hasMarked == 1});
+
+        while (!frames.empty()) {
+            Frame& top = frames.back();
+            if (top.numRemaining == 0) {
+                top.cell->adoptChildren(children.data() + top.childrenStart,
+                                        children.data() + children.size(), top.isIndexed);
+                children.resize(top.childrenStart);
+                frames.pop_back();
+                continue;
+            }
+            top.numRemaining--;
+            std::uint64_t offset = top.nextOffset + readNum(in);
+            if (offset >= top.cell->value) throw std::runtime_error("memory image is malformed");
+            top.nextOffset = offset + 1;
+
+            MemoryCell* child = new MemoryCell(readValue());
+            children.emplace_back(toNum(offset), child);
+            std::size_t depth = frames.size();
+            bool isOnPath = top.isOnPath && depth <= path.size() && path[depth - 1] == offset;
+            if (isOnPath && depth == path.size()) marked = child;
+
+            numChildren = readChildren(child, header);
+            if (numChildren != 0) {
+                frames.push_back({child, numChildren, 0, children.size(), (header & HEADER_INDEXED) != 0, isOnPath});
+            }
+        }
+    } catch (...) {
+        // the cells which haven't been handed to their parents yet own everything else
+        for (auto [offset, child] : children) delete child;
+        delete root;
+        throw;
+    }
+    if (hasMarked == 1 && marked == nullptr) throw std::runtime_error("memory image's marked cell doesn't exist");
+    return root;
+}
+
+void MemoryImage::writeNum(std::ostream& out, std::uint64_t value) {
+    while (value >= 0x80) {
+        out.put(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.put(static_cast<char>(value));
+}
+
+std::uint64_t MemoryImage::readNum(std::istream& in) {
+    std::uint64_t value = 0;
+    for (unsigned int shift = 0; shift < 64; shift += 7) {
+        int byte = in.get();
+        if (byte == std::istream::traits_type::eof()) throw std::runtime_error("memory image ended unexpectedly");
+        value |= std::uint64_t(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) return value;
+    }
+    throw std::runtime_error("memory image contains a number which is too large");
+}
+
+template <typename Function>
+void MemoryImage::forEachChild(const MemoryCell& cell, Function f) {
+    const MemoryCell& source = cell.isShared() ? *cell.sharedSource : cell;
+
+    if (source.isIndexed()) {
+        const ChildIndex& index = *source.childIndex;
+        num first = index.first();
+        // the index goes in order of position, so the children from the first one onwards come first
+        index.forEach([first, &f](num pos, const MemoryCell* child) {
+            if (pos >= first) f(pos - first, child);
+        });
+        index.forEach([first, &f, &index](num pos, const MemoryCell* child) {
+            if (pos < first) f(pos + (index.size() - first), child);
+        });
+        return;
+    }
+
+    const MemoryCell* first = source.firstChild;
+    if (first == nullptr) return;
+    // if the loop isn't full, the children after the gap are the rest of the segment, which is
+    // behind the first child
+    num numChildren = source.numChildrenInstantiated;
+    num offset = 0;
+    const MemoryCell* curr = first;
+    for (num i = 0; i < numChildren; i++) {
+        f(offset, curr);
+        offset = curr->isGapAfter() ? source.value - (numChildren - i - 1) : offset + 1;
+        curr = curr->nextSibling;
+    }
+}
+
+num MemoryImage::offsetOf(const MemoryCell& cell) {
+    const MemoryCell& parent = *cell.parent;
+    if (parent.isIndexed()) {
+        const ChildIndex& index = *parent.childIndex;
+        return index.back(index.positionOf(&cell), index.first());
+    }
+    // look forwards from the first child, jumping to the end of the loop if we cross the gap
+    num numBefore = 0;
+    num offset = 0;
+    for (const MemoryCell* curr = parent.firstChild; curr != &cell; curr = curr->nextSibling) {
+        numBefore++;
+        offset = curr->isGapAfter() ? parent.value - (parent.numChildrenInstantiated - numBefore) : offset + 1;
+    }
+    return offset;
+}
@@ -0,0 +1,60 @@
+// memory_image.h
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+#include "definitions.h"
+#include "memory_cell.h"
+
+namespace spherehorn {
+
+// Reads and writes memory trees in a compact binary format, including loops which are only partly
+// instantiated. Neither direction recurses, so trees of any depth can be read and written.
+//
+// The format is a preorder walk of the tree. Each cell is written as its value, followed by the
+// number of instantiated children it has (shifted left by two, with bit 0 set if its children are
+// INDEXED and bit 1 set if they're PACKED), followed by each instantiated child. The children are
+// written in order starting from the first child, and each is preceded by the number of
+// uninstantiated children between it and the previous one. PACKED children are written as just
+// their values instead. Every number is an unsigned LEB128 varint.
+//
+// Before the tree is the path to a "marked" cell (e.g. the memory pointer): a flag byte saying
+// whether there is one, then the length of the path, then the position of each cell along it
+// relative to its parent's first child.
+//
+// Trees can also be written as Spherehorn memory literals, for people to read (or to paste into a
+// program). Cells whose children have never been instantiated are written as just their values.
+class MemoryImage {
+public:
+    // Write the tree rooted at root, marking the given cell, which may be null
+    static void write(std::ostream& out, const MemoryCell& root, const MemoryCell* marked);
+    // Write the tree rooted at root as a memory literal, with a comment just before the marked cell
+    // (if it isn't null)
+    static void writeLiteral(std::ostream& out, const MemoryCell& root, const MemoryCell* marked);
+    // Read a tree, returning its root and setting marked to the marked cell (or null). Throws
+    // std::runtime_error if the input is malformed.
+    static MemoryCell* read(std::istream& in, MemoryCell*& marked);
+
+    static void writeNum(std::ostream& out, std::uint64_t value);
+    static std::uint64_t readNum(std::istream& in);
+
+private:
+    // flags in the low bits of a cell's header
+    static constexpr std::uint64_t HEADER_INDEXED = 1;
+    static constexpr std::uint64_t HEADER_PACKED = 2;
+    // writeLiteral() starts a new line rather than going past this many characters, where it can
+    static constexpr std::size_t LITERAL_LINE_LENGTH = 100;
+
+    // Call f(offset, child) for each of cell's instantiated children, in order of their offset from
+    // the first child. A SHARED cell's children are those of its source.
+    template <typename Function>
+    static void forEachChild(const MemoryCell& cell, Function f);
+    // Return the offset of an instantiated cell from its parent's first child
+    static num offsetOf(const MemoryCell& cell);
+};
+
+}
@@ -1,17 +1,30 @@
 // program.cpp
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
 #include <iostream>
 #include <string>
 #include <istream>
 #include <sstream>
 #include <charconv>
 #include <stdexcept>
+#include <vector>
 #include "definitions.h"
 #include "program_state.h"
 #include "instruction_container.h"
 #include "instruction_block.h"
 #include "instructions/instructions.h"
+#include "bytecode.h"
+#include "jit.h"
+#include "cpp_emitter.h"
 #include "tokenizer.h"
+#include "checkpoint.h"
+#include "memory_image.h"
+#include "mapped_file.h"
+#include "literal_pool.h"
 #include "program.h"
 using namespace spherehorn;
 using std::string;
@@ -26,10 +39,112 @@ Status Program::run() {
     if (isParseError_) throw std::runtime_error("attempted to run a program with a parse error");
     if (hasBeenRun_) throw std::runtime_error("attempted to re-run a program");
     hasBeenRun_ = true;
-    Status exit_status = instrs_->run(state_);
+    // A program which is resuming goes straight back into its top-level block, since it was already
+    // running. It stops each time we need to take a checkpoint, and then carries on from there.
+    InstructionBlock& block = static_cast<InstructionBlock&>(*instrs_);
+    auto runBlock = [this, &block]() {
+        if (jit_) return jit_->run(state_);
+        if (bytecode_) return bytecode_->run(state_);
+        return state_.isResuming() ? block.action(state_) : block.run(state_);
+    };
+    Status exit_status = runBlock();
+    while (exit_status == Status::SUSPEND) {
+        saveCheckpoint();
+        exit_status = runBlock();
+    }
+    // don't leave anything for the reclaimer once the program's over
+    MemoryCell::reclaimAll();
     return exit_status == Status::ABORT ? Status::ABORT : Status::EXIT;
 }
 
+void Program::enableCheckpoints(const std::string& path, std::uint64_t interval) {
+    checkpointPath_ = path;
+    checkpointInterval_ = interval;
+    state_.untilCheckpoint = interval == 0 ? UINT64_MAX : interval;
+}
+
+void Program::restore(std::istream& input) {
+    if (isParseError_) throw std::runtime_error("attempted to restore a program with a parse error");
+    if (hasBeenRun_) throw std::runtime_error("attempted to restore a program which has been run");
+    ProgramState restored = state_;
+    cell_ptr memory (Checkpoint::load(input, restored));
+    const InstructionBlock& block = static_cast<const InstructionBlock&>(*instrs_);
+    if (!restored.position.empty() && !block.isValidPosition(restored.position)) {
+        throw std::runtime_error("checkpoint was saved by a different program");
+    }
+    state_ = std::move(restored);
+    memory_ = std::move(memory);
+}
+
+void Program::loadMemory(const std::string& path, bool isImage) {
+    if (hasBeenRun_) throw std::runtime_error("attempted to load memory into a program which has been run");
+    // the file is built into a tree straight from the mapping, without going through the tokenizer
+    MappedFile file (path);
+    cell_ptr memory;
+    if (isImage) {
+        // a dump records where the memory pointer was, but a program always starts at the beginning
+        MemoryCell* marked = nullptr;
+        memory.reset(MemoryImage::read(file.stream(), marked));
+    } else {
+        if (file.size() > num(-1)) throw std::runtime_error("file " + path + " is too long to be a string");
+        memory.reset(new MemoryCell());
+        memory->setLeaves(std::vector<num>(file.bytes(), file.bytes() + file.size()));
+    }
+    // the memory pointer has to start on a child of the root
+    if (memory->getVal() == 0) throw std::runtime_error("file " + path + " has no memory cells in it");
+    memory_ = std::move(memory);
+    state_.memoryPtr = memory_->getChild();
+}
+
+void Program::compile(Jit::Mode jit) {
+    if (isParseError_) throw std::runtime_error("attempted to compile a program with a parse error");
+    jit_.reset();
+    bytecode_ = std::make_unique<Bytecode>(static_cast<InstructionBlock&>(*instrs_));
+    if (jit == Jit::Mode::OFF) return;
+    try {
+        jit_ = std::make_unique<Jit>(*bytecode_);
+    } catch (const std::runtime_error&) {
+        // otherwise the bytecode will do
+        if (jit == Jit::Mode::ON) throw;
+    }
+}
+
+void Program::compactMemory() {
+    if (memory_) MemoryCell::compact(*memory_, state_.memoryPtr);
+}
+
+void Program::emitCpp(std::ostream& out) const {
+    if (isParseError_) throw std::runtime_error("attempted to compile a program with a parse error");
+    CppEmitter::emit(out, static_cast<const InstructionBlock&>(*instrs_), state_, *memory_);
+}
+
+void Program::dumpMemory(std::ostream& out, bool binary) const {
+    if (!memory_) return;
+    if (binary) {
+        MemoryImage::write(out, *memory_, state_.memoryPtr);
+    } else {
+        MemoryImage::writeLiteral(out, *memory_, state_.memoryPtr);
+    }
+}
+
+void Program::saveCheckpoint() {
+    // the blocks recorded their positions from the innermost one outwards
+    std::reverse(state_.position.begin(), state_.position.end());
+    state_.resumeDepth = 0;
+    if (!checkpointPath_.empty()) {
+        // write to a temporary file first, so that a crash can't leave a half-written checkpoint
+        std::string tempPath = checkpointPath_ + ".tmp";
+        std::ofstream output (tempPath, std::ios::binary | std::ios::trunc);
+        Checkpoint::save(output, state_, memory_.get());
+        output.close();
+        if (!output || std::rename(tempPath.c_str(), checkpointPath_.c_str()) != 0) {
+            std::cerr << "Warning: could not save a checkpoint to " << checkpointPath_ << std::endl;
+        }
+    }
+    state_.untilCheckpoint = checkpointInterval_ == 0 ? UINT64_MAX : checkpointInterval_;
+    Checkpoint::isRequested = 0;
+}
+
 Program::Program(std::istream&& input) : tokens_(std::move(input)) {
     bool seenInstructionBlock = false;
     bool seenInitialMemory = false;
@@ -81,6 +196,8 @@ Program::Program(std::istream&& input) : tokens_(std::move(input)) {
 
     if (memory_) state_.memoryPtr = memory_->getChild();
     Arguments::Argument::setStatePtr(&state_);
+    // the instructions hold their own references to the literals they use
+    literals_.clear();
 }
 
 instr_ptr Program::parseInstructionBlock() {
@@ -149,9 +266,10 @@ instr_ptr Program::parseMemorySetter(const Token& code) {
     } else if (value.isMemoryLiteral()) {
         MemoryCell* cell = parseLiteralAsMemory();
         Condition condition = parseCondition();
-        instr_ptr result (new Instructions::SetMemory(condition, std::move(*cell)));
+        // identical literals all share the same tree
+        SharedTree* tree = literals_.intern(std::move(*cell));
         delete cell; // TODO: this is kind of kludgy
-        return result;
+        return instr_ptr(new Instructions::SetMemory(condition, tree));
     } else {
         std::cerr << "Parse error: invalid memory value for `.` instruction "
                      "(line " << tokens_.line() << ")" << std::endl;
@@ -335,12 +453,37 @@ MemoryCell* Program::parseMemoryBlock() {
     if (tokens_.next().str != "(") throw std::runtime_error("first token of memory block is not '('");
 
     MemoryCell* result = new MemoryCell();
+    // Until an element turns up which has elements of its own, the elements are just values. If
+    // they stay that way, they're stored PACKED (or not at all, if they're all zeros) rather than
+    // as cells, and only become cells if the program goes into this loop.
+    std::vector<num> leaves;
+    bool isLeaves = true;
+    bool isAllZero = true;
 
     for (Token token = tokens_.peek();
          token.str != ")" && token.type != Token::END;
          token = tokens_.peek()) {
         if (token.isMemoryLiteral()) {
+            if (leaves.size() + result->getVal() == num(-1)) {
+                std::cerr << "Parse error: memory block has too many elements "
+                             "(line " << tokens_.line() << ")" << std::endl;
+                isParseError_ = true;
+                delete parseLiteralAsMemory();
+                continue;
+            }
+            if (isLeaves && token.isNumericLiteral()) {
+                num value = parseLiteralAsNumber();
+                if (value != 0) isAllZero = false;
+                leaves.push_back(value);
+                continue;
+            }
             MemoryCell* newCell = parseLiteralAsMemory();
+            if (isLeaves) {
+                // this loop needs cells after all
+                for (num value : leaves) result->insertChild(new MemoryCell(value));
+                leaves.clear();
+                isLeaves = false;
+            }
             result->insertChild(newCell);
         } else {
             std::cerr << "Parse error: invalid memory token `" << token.str << "` "
@@ -358,7 +501,14 @@ MemoryCell* Program::parseMemoryBlock() {
         isParseError_ = true;
     }
     // if we're not going to use thisCell, we may as well free its children now
-    if (isParseError_) result->reset();
+    if (isParseError_) {
+        result->reset();
+    } else if (isLeaves && isAllZero) {
+        // zeros are what uninstantiated cells hold anyway
+        result->setVal(toNum(leaves.size()));
+    } else if (isLeaves) {
+        result->setLeaves(std::move(leaves));
+    }
 
     return result;
 }
@@ -410,6 +560,11 @@ num Program::parseIntegerLiteral() {
         std::cerr << "Parse error: invalid integer literal `" << token.str << "` "
                      "(line " << tokens_.line() << ")" << std::endl;
         isParseError_ = true;
+    } else if (result.ec == std::errc::result_out_of_range) {
+        std::cerr << "Parse error: integer literal `" << token.str << "` is too large "
+                     "(line " << tokens_.line() << ")\n"
+                     " -> Hint: this build's memory cells are " << SPHEREHORN_CELL_BITS << " bits wide" << std::endl;
+        isParseError_ = true;
     }
     return value;
 }
@@ -472,6 +627,12 @@ MemoryCell* Program::parseStringLiteral() {
         }
     }
 
+    if (str.view().size() > num(-1)) {
+        std::cerr << "Parse error: string literal is too long "
+                     "(line " << tokens_.line() << ")" << std::endl;
+        isParseError_ = true;
+        return new MemoryCell();
+    }
     return new MemoryCell(str.str());
 }
 
@@ -550,7 +711,7 @@ char Program::parseChar(const char*& charPtr) {
             // from going beyond the end of the string if the escape is malformed.
             charPtr += 2;
         }
-        return value;
+        return static_cast<char>(value);
     }
     default:
         std::cerr << "Parse error: invalid character escape sequence `\\" << escapeChar << "` "
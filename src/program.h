@@ -2,14 +2,19 @@
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <istream>
+#include <ostream>
 #include <sstream>
 #include <string>
 #include "definitions.h"
 #include "program_state.h"
 #include "instructions/instructions.h"
+#include "bytecode.h"
+#include "jit.h"
 #include "tokenizer.h"
+#include "literal_pool.h"
 
 namespace spherehorn {
 
@@ -20,14 +25,48 @@ private:
     ProgramState state_;
     cell_ptr memory_;
     instr_ptr instrs_;
+    // the instructions lowered to bytecode, if compile() has been called
+    std::unique_ptr<Bytecode> bytecode_;
+    // the bytecode translated to native code, if compile() was asked to and could
+    std::unique_ptr<Jit> jit_;
     Tokenizer tokens_;
+    // the literals of `.` instructions, while the program is being parsed
+    LiteralPool literals_;
     bool isParseError_ = false;
     bool hasBeenRun_ = false;
+    // where to save checkpoints, and how many instructions to run between them (0 means only when
+    // one is requested)
+    std::string checkpointPath_;
+    std::uint64_t checkpointInterval_ = 0;
 public:
     Program(std::istream&& input);
     Status run();
     constexpr bool isParseError() const { return isParseError_; }
+    // Save a checkpoint to the given file every interval instructions (if interval is nonzero), and
+    // whenever Checkpoint::request() is called
+    void enableCheckpoints(const std::string& path, std::uint64_t interval);
+    // Replace the program's state with one saved by a checkpoint of the same program, so that
+    // running it carries on from there. Throws std::runtime_error if the checkpoint is invalid or
+    // doesn't fit this program.
+    void restore(std::istream& input);
+    // Replace the program's initial memory with the contents of a file, which is either a binary
+    // MemoryImage (as written by dumpMemory()) or, if isImage is false, raw bytes which become a
+    // string. Throws std::runtime_error if the file can't be read or isn't valid.
+    void loadMemory(const std::string& path, bool isImage);
+    // Lower the program to bytecode (see bytecode.h), which run() then uses instead of walking the
+    // tree of instructions, and translate that to native code (see jit.h) according to jit. Throws
+    // std::runtime_error if the program can't be lowered, or if jit is ON and it can't be translated.
+    void compile(Jit::Mode jit = Jit::Mode::OFF);
+    // Move the memory tree's cells next to each other in the order the program walks them (see
+    // MemoryCell::compact())
+    void compactMemory();
+    // Write out the memory tree, as a memory literal or as a binary MemoryImage, marking the cell
+    // the memory pointer is at
+    void dumpMemory(std::ostream& out, bool binary) const;
+    // Write the program, with its current memory, as a standalone C++ program (see cpp_emitter.h)
+    void emitCpp(std::ostream& out) const;
 private:
+    void saveCheckpoint();
     // For instructions:
     instr_ptr parseInstructionBlock();
     instr_ptr parseInstruction();
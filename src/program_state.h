@@ -2,6 +2,9 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <vector>
 #include "definitions.h"
 #include "memory_cell.h"
 
@@ -11,6 +14,14 @@ struct ProgramState {
     num accRegister = 0;
     bool condRegister = false;
     MemoryCell* memoryPtr = nullptr;
+    // The index of the instruction to run next in each enclosing block, outermost first. This is
+    // filled in when the program suspends (see Status::SUSPEND), and used up as it resumes.
+    std::vector<unsigned int> position;
+    std::size_t resumeDepth = 0;
+    // the number of instructions to run before suspending to take a checkpoint
+    std::uint64_t untilCheckpoint = UINT64_MAX;
+
+    bool isResuming() const { return resumeDepth < position.size(); }
 };
 
 }
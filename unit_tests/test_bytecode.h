@@ -0,0 +1,220 @@
+// test_bytecode.h
+
+#pragma once
+
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include "../src/program_state.h"
+#include "../src/memory_cell.h"
+#include "../src/bytecode.h"
+#include "../src/instruction_block.h"
+#include "../src/instructions/instructions.h"
+#include "../src/program.h"
+#include "unit_tests.h"
+using namespace spherehorn;
+using namespace std;
+
+void testBytecode() {
+    startGroup("Testing bytecode");
+
+    name = "Lowering blocks";
+    // { ++ { break? } -- }
+    auto lowerInc = instr_ptr(new Instructions::Increment(Condition::ALWAYS));
+    auto lowerBreak = instr_ptr(new Instructions::Break(Condition::WHEN_TRUE));
+    auto lowerDec = instr_ptr(new Instructions::Decrement(Condition::WHEN_FALSE));
+    instr_ptr lowerInner (new InstructionBlock());
+    static_cast<InstructionBlock&>(*lowerInner).insertInstr(lowerBreak);
+    InstructionBlock lowerOuter;
+    lowerOuter.insertInstr(lowerInc);
+    lowerOuter.insertInstr(lowerInner);
+    lowerOuter.insertInstr(lowerDec);
+    Bytecode lowered (lowerOuter);
+    const vector<Bytecode::Instruction>& code = lowered.instructions();
+    vector<Bytecode::Op> ops;
+    for (const Bytecode::Instruction& instr : code) ops.push_back(instr.op);
+    using Op = Bytecode::Op;
+    assert(ops == vector<Op>({Op::Block, Op::Increment, Op::Block, Op::Break, Op::Jump, Op::End,
+                              Op::Decrement, Op::Jump, Op::Exit}), == true);
+    assert(code[0].target, == 8);
+    assert(code[2].target, == 5);
+    assert(code[3].target, == 5);
+    assert(code[3].skip, == Bytecode::SKIP_WHEN_FALSE);
+    assert(code[4].target, == 3);
+    assert(code[6].skip, == Bytecode::SKIP_WHEN_TRUE);
+    assert(code[7].target, == 1);
+
+    name = "Lowering blocks (empty)";
+    instr_ptr emptyInner (new InstructionBlock());
+    InstructionBlock emptyOuter;
+    emptyOuter.insertInstr(emptyInner);
+    bool isException = false;
+    try {
+        Bytecode empty (emptyOuter);
+    } catch (runtime_error& e) {
+        isException = true;
+    }
+    assert(isException,);
+
+    const char* counter = "{ numin > { .a numout > chout > >= m; break? > ++ } break } (0 0 '\\n')";
+
+    name = "Running bytecode";
+    toCin.str("3\n");
+    fromCout.str("");
+    Program counterProg (stringstream{counter});
+    counterProg.compile();
+    assert(counterProg.run(), == Status::EXIT);
+    assert(fromCout.str(), == "0\n1\n2\n3\n");
+
+    name = "Running bytecode (errors)";
+    fromCerr.str("");
+    Program errorProg (stringstream("{ ++ -- -- } (0)"));
+    errorProg.compile();
+    assert(errorProg.run(), == Status::ABORT);
+    assert(fromCerr.str(), == "Error: Attempted decrement past zero\n");
+
+    name = "Suspending bytecode";
+    // the same program as "Suspending blocks" in test_checkpoint.h, which should stop at the same points
+    ProgramState state;
+    resetState(state);
+    auto inc1 = instr_ptr(new Instructions::Increment(Condition::ALWAYS));
+    auto inc2 = instr_ptr(new Instructions::Increment(Condition::ALWAYS));
+    auto break1 = instr_ptr(new Instructions::Break(Condition::ALWAYS));
+    instr_ptr inner (new InstructionBlock());
+    static_cast<InstructionBlock&>(*inner).insertInstr(inc2);
+    static_cast<InstructionBlock&>(*inner).insertInstr(break1);
+    InstructionBlock outer;
+    outer.insertInstr(inc1);
+    outer.insertInstr(inner);
+    Bytecode suspending (outer);
+    state.untilCheckpoint = 2;
+    assert(suspending.run(state), == Status::SUSPEND);
+    assert(state.accRegister, == 12);
+    assert(state.position == vector<unsigned int>({1, 1}), == true);
+    state.untilCheckpoint = 3;
+    assert(suspending.run(state), == Status::SUSPEND);
+    assert(state.accRegister, == 14);
+    assert(state.position == vector<unsigned int>({1, 1}), == true);
+
+    name = "Suspending bytecode (resuming the tree)";
+    state.untilCheckpoint = 3;
+    assert(outer.action(state), == Status::SUSPEND);
+    assert(state.accRegister, == 16);
+    assert(state.position == vector<unsigned int>({1, 1}), == true);
+    state.position.clear();
+    state.untilCheckpoint = UINT64_MAX;
+
+    name = "Checkpoint interval (bytecode)";
+    toCin.str("12\n");
+    fromCout.str("");
+    Program intervalProg (stringstream{counter});
+    intervalProg.compile();
+    intervalProg.enableCheckpoints("", 5);
+    assert(intervalProg.run(), == Status::EXIT);
+    assert(fromCout.str(), == "0\n1\n2\n3\n4\n5\n6\n7\n8\n9\n10\n11\n12\n");
+
+#if SPHEREHORN_CELL_BITS >= 32 // these use values which don't fit in narrower cells
+    name = "Tracing loops";
+    // { ++ >= 2000 break? --? }
+    auto traceInc = instr_ptr(new Instructions::Increment(Condition::ALWAYS));
+    auto traceCompare = instr_ptr(new Instructions::GreaterOrEqual(Condition::ALWAYS, createConstArg(2000)));
+    auto traceBreak = instr_ptr(new Instructions::Break(Condition::WHEN_TRUE));
+    auto traceDec = instr_ptr(new Instructions::Decrement(Condition::WHEN_TRUE));
+    InstructionBlock traceLoop;
+    traceLoop.insertInstr(traceInc);
+    traceLoop.insertInstr(traceCompare);
+    traceLoop.insertInstr(traceBreak);
+    traceLoop.insertInstr(traceDec);
+    Bytecode traced (traceLoop);
+    resetState(state);
+    state.accRegister = 0;
+    assert(traced.trace(0) == nullptr, == true);
+    assert(traced.run(state), == Status::EXIT);
+    assert(state.accRegister, == 2000);
+    assert(state.condRegister, == true);
+    // the decrement is skipped whenever the break is, so it needs no guard of its own
+    const vector<Bytecode::TraceStep>* steps = traced.trace(0);
+    assert(steps != nullptr, == true);
+    assert(steps->size(), == 3);
+    assert((*steps)[0].instr.op == Op::Increment, == true);
+    assert((*steps)[1].instr.op == Op::GreaterOrEqual, == true);
+    assert((*steps)[1].guard == Bytecode::Guard::NONE, == true);
+    assert((*steps)[2].instr.op == Op::End, == true);
+    assert((*steps)[2].guard == Bytecode::Guard::WHEN_FALSE, == true);
+    assert((*steps)[2].pc, == 3);
+    assert((*steps)[2].completed, == 2);
+
+    name = "Tracing loops (guards)";
+    // { ++ >= 1500 ++? >= 5000 break? }, which takes another path through the loop halfway
+    auto guardInc1 = instr_ptr(new Instructions::Increment(Condition::ALWAYS));
+    auto guardCompare1 = instr_ptr(new Instructions::GreaterOrEqual(Condition::ALWAYS, createConstArg(1500)));
+    auto guardInc2 = instr_ptr(new Instructions::Increment(Condition::WHEN_TRUE));
+    auto guardCompare2 = instr_ptr(new Instructions::GreaterOrEqual(Condition::ALWAYS, createConstArg(5000)));
+    auto guardBreak = instr_ptr(new Instructions::Break(Condition::WHEN_TRUE));
+    InstructionBlock guardLoop;
+    guardLoop.insertInstr(guardInc1);
+    guardLoop.insertInstr(guardCompare1);
+    guardLoop.insertInstr(guardInc2);
+    guardLoop.insertInstr(guardCompare2);
+    guardLoop.insertInstr(guardBreak);
+    Bytecode guarded (guardLoop);
+    resetState(state);
+    state.accRegister = 0;
+    assert(guarded.run(state), == Status::EXIT);
+    assert(state.accRegister, == 5001);
+    // the first trace kept failing, so the loop was traced again
+    steps = guarded.trace(0);
+    assert(steps != nullptr, == true);
+    assert(steps->size(), == 5);
+    assert((*steps)[2].instr.op == Op::Increment, == true);
+    assert((*steps)[2].guard == Bytecode::Guard::WHEN_TRUE, == true);
+
+    name = "Tracing loops (abandoned recordings)";
+    // { ++ = 1001 ?{ break } >= 5000 break? }, whose first recorded iteration goes into the inner block
+    auto abandonInc = instr_ptr(new Instructions::Increment(Condition::ALWAYS));
+    auto abandonCompare1 = instr_ptr(new Instructions::Equal(Condition::ALWAYS, createConstArg(1001)));
+    auto abandonInnerBreak = instr_ptr(new Instructions::Break(Condition::ALWAYS));
+    instr_ptr abandonInner (new InstructionBlock(Condition::WHEN_TRUE));
+    static_cast<InstructionBlock&>(*abandonInner).insertInstr(abandonInnerBreak);
+    auto abandonCompare2 = instr_ptr(new Instructions::GreaterOrEqual(Condition::ALWAYS, createConstArg(5000)));
+    auto abandonBreak = instr_ptr(new Instructions::Break(Condition::WHEN_TRUE));
+    InstructionBlock abandonLoop;
+    abandonLoop.insertInstr(abandonInc);
+    abandonLoop.insertInstr(abandonCompare1);
+    abandonLoop.insertInstr(abandonInner);
+    abandonLoop.insertInstr(abandonCompare2);
+    abandonLoop.insertInstr(abandonBreak);
+    Bytecode abandoned (abandonLoop);
+    resetState(state);
+    state.accRegister = 0;
+    assert(abandoned.run(state), == Status::EXIT);
+    assert(state.accRegister, == 5000);
+    // the loop became hot again after the first recording was abandoned
+    steps = abandoned.trace(0);
+    assert(steps != nullptr, == true);
+    assert((*steps)[2].instr.op == Op::End, == true);
+    assert((*steps)[2].guard == Bytecode::Guard::WHEN_FALSE, == true);
+
+    name = "Tracing loops (checkpoints)";
+    // traces should suspend at the same point as the tree
+    Bytecode suspendingTrace (traceLoop);
+    resetState(state);
+    state.accRegister = 0;
+    state.untilCheckpoint = 2501;
+    assert(suspendingTrace.run(state), == Status::SUSPEND);
+    assert(state.accRegister, == 626);
+    assert(state.position == vector<unsigned int>({1}), == true);
+    resetState(state);
+    state.position.clear();
+    state.accRegister = 0;
+    state.untilCheckpoint = 2501;
+    assert(traceLoop.action(state), == Status::SUSPEND);
+    assert(state.accRegister, == 626);
+    assert(state.position == vector<unsigned int>({1}), == true);
+    state.position.clear();
+    state.untilCheckpoint = UINT64_MAX;
+#endif
+
+    endGroup();
+}
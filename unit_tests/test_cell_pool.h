@@ -0,0 +1,165 @@
+// test_cell_pool.h
+
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "unit_tests.h"
+#include "../src/cell_pool.h"
+using namespace spherehorn;
+using namespace std;
+
+void testCellPool() {
+    startGroup("Testing the CellPool class");
+
+    name = "Allocate";
+    CellPool pool (sizeof(MemoryCell));
+    void* slot1 = pool.allocate();
+    void* slot2 = pool.allocate();
+    assert(slot1, != slot2);
+    assert(pool.numLive(), == 2);
+    assert(pool.numSlabs(), == 1);
+
+    name = "Recycle";
+    pool.deallocate(slot1);
+    assert(pool.numLive(), == 1);
+    void* slot3 = pool.allocate();
+    assert(slot3, == slot1);
+
+    name = "Many slabs";
+    vector<void*> slots;
+    for (int i = 0; i < 10000; i++) {
+        slots.push_back(pool.allocate());
+    }
+    assert(pool.numSlabs(), > 1);
+    assert(pool.numLive(), == 10002);
+
+    name = "Bulk release";
+    for (void* slot : slots) {
+        pool.deallocate(slot);
+    }
+    pool.deallocate(slot2);
+    assert(pool.numSlabs(), > 1);
+    pool.deallocate(slot3);
+    assert(pool.numLive(), == 0);
+    assert(pool.numSlabs(), == 0);
+
+    name = "Peak and limit";
+    CellPool limitPool (16);
+    limitPool.setLimit(2);
+    void* limitSlot1 = limitPool.allocate();
+    void* limitSlot2 = limitPool.allocate();
+    assert(limitPool.isOverLimit(), == false);
+    void* limitSlot3 = limitPool.allocate();
+    assert(limitPool.isOverLimit(), == true);
+    limitPool.deallocate(limitSlot3);
+    limitPool.deallocate(limitSlot2);
+    // the limit was still exceeded, even though the memory has been freed since
+    assert(limitPool.isOverLimit(), == true);
+    limitPool.setLimit(2);
+    assert(limitPool.isOverLimit(), == false);
+    assert(limitPool.numLive(), == 1);
+    assert(limitPool.peakLive(), == 3);
+    limitPool.deallocate(limitSlot1);
+
+    name = "Charged bytes";
+    CellPool chargePool (16);
+    chargePool.setLimit(4);
+    void* chargeSlot1 = chargePool.allocate();
+    chargePool.charge(40);
+    assert(chargePool.numBytes(), == 56);
+    assert(chargePool.isOverLimit(), == false);
+    // the charge which goes over the limit flags it
+    chargePool.charge(16);
+    assert(chargePool.isOverLimit(), == true);
+    chargePool.refund(56);
+    assert(chargePool.isOverLimit(), == true);
+    assert(chargePool.peakBytes(), == 72);
+    // and so does an allocation
+    chargePool.setLimit(4);
+    assert(chargePool.isOverLimit(), == false);
+    void* chargeSlots[4];
+    for (void*& slot : chargeSlots) slot = chargePool.allocate();
+    assert(chargePool.isOverLimit(), == true);
+    for (void* slot : chargeSlots) chargePool.deallocate(slot);
+    chargePool.deallocate(chargeSlot1);
+    assert(chargePool.numBytes(), == 0);
+
+    name = "Sorted free list";
+    CellPool sortPool (16);
+    vector<void*> sortSlots;
+    for (int i = 0; i < 6; i++) sortSlots.push_back(sortPool.allocate());
+    sortPool.deallocate(sortSlots[4]);
+    sortPool.deallocate(sortSlots[1]);
+    sortPool.deallocate(sortSlots[3]);
+    assert(sortPool.numRecycled(), == 0);
+    sortPool.sortFreeList();
+    assert(sortPool.allocate(), == sortSlots[1]);
+    assert(sortPool.allocate(), == sortSlots[3]);
+    assert(sortPool.allocate(), == sortSlots[4]);
+    assert(sortPool.numRecycled(), == 3);
+    for (void* slot : sortSlots) sortPool.deallocate(slot);
+
+    name = "Region";
+    CellPool regionPool (16, 1 << 16);
+    assert(regionPool.hasRegion(),);
+    void* regionSlot1 = regionPool.allocate();
+    void* regionSlot2 = regionPool.allocate();
+    assert(regionPool.inRegion(regionSlot1),);
+    assert(regionSlot1, != regionPool.regionBase()); // the first slot stands for null
+    assert(static_cast<byte*>(regionSlot2) - static_cast<byte*>(regionSlot1), == 16);
+    int outsideRegion = 0;
+    assert(regionPool.inRegion(&outsideRegion), == false);
+    uint32_t externalRef = regionPool.externalRef(&outsideRegion);
+    assert(CellPool::isExternalRef(externalRef),);
+    assert(regionPool.externalAt(externalRef), == &outsideRegion);
+    assert(regionPool.externalRef(&outsideRegion), == externalRef);
+    regionPool.forgetExternal(&outsideRegion);
+    regionPool.deallocate(regionSlot1);
+    regionPool.deallocate(regionSlot2);
+    assert(regionPool.numSlabs(), == 0);
+
+    name = "File region";
+    CellPool filePool (16);
+    string poolPath = (filesystem::temp_directory_path() / "spherehorn_test_pool").string();
+    assert(filePool.mapFile(poolPath, 1 << 16),);
+    assert(filePool.isFileBacked(),);
+    assert(filesystem::exists(poolPath), == false);
+    void* fileSlot1 = filePool.allocate();
+    void* fileSlot2 = filePool.allocate();
+    assert(filePool.inRegion(fileSlot1),);
+    *static_cast<int*>(fileSlot2) = 5;
+    assert(*static_cast<int*>(fileSlot2), == 5);
+    filePool.deallocate(fileSlot1);
+    filePool.deallocate(fileSlot2);
+    assert(filePool.numSlabs(), == 0);
+    assert(filePool.mapFile("/nonexistent/spherehorn_test_pool", 1 << 16), == false);
+
+#ifdef SPHEREHORN_COMPACT_CELLS
+    name = "Compact layout";
+    // four links (one of which doubles as the slot) and the value and count, padded to a multiple
+    // of 8 bytes, since the layout, stats and gap links are kept in the links' tags
+    assert(sizeof(MemoryCell), == (4 * sizeof(uint32_t) + 2 * sizeof(num) + 7) / 8 * 8);
+    MemoryCell compactParent (2);
+    MemoryCell* compactChild = compactParent.getChild();
+    assert(MemoryCell::pool().inRegion(compactChild),);
+    assert(compactChild->getParent(), == &compactParent);
+    assert(compactChild->getNext()->getNext(), == compactChild);
+#else
+    name = "Tagged layout";
+    // four links (one of which doubles as the slot) and the value and count, padded to a multiple of
+    // 8 bytes, since the layout, stats and gap links are kept in the links' tags
+    assert(sizeof(MemoryCell), == (4 * sizeof(void*) + 2 * sizeof(num) + 7) / 8 * 8);
+#endif
+
+    name = "MemoryCell uses the pool";
+    size_t liveBefore = MemoryCell::pool().numLive();
+    MemoryCell* cell = new MemoryCell(3);
+    cell->getChild()->getNext();
+    assert(MemoryCell::pool().numLive(), == liveBefore + 3);
+    delete cell;
+    assert(MemoryCell::pool().numLive(), == liveBefore);
+
+    endGroup();
+}
@@ -0,0 +1,193 @@
+// test_checkpoint.h
+
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include "../src/program_state.h"
+#include "../src/memory_cell.h"
+#include "../src/memory_image.h"
+#include "../src/checkpoint.h"
+#include "../src/instruction_block.h"
+#include "../src/instructions/instructions.h"
+#include "../src/program.h"
+#include "unit_tests.h"
+using namespace spherehorn;
+using namespace std;
+
+void testCheckpoint() {
+    startGroup("Testing checkpoints");
+
+    name = "Memory image (round trip)";
+    MemoryCell imageRoot (5);
+    // a partly instantiated loop, with children on both sides of the first one
+    MemoryCell* imageLinked = imageRoot.getChild();
+    imageLinked->setVal(200);
+    imageLinked->getChild()->setVal(1);
+    imageLinked->getChild()->getNext()->setVal(2);
+    imageLinked->getChild()->getPrev()->setVal(3);
+    // an indexed loop which has been rotated
+    MemoryCell* imageIndexed = imageLinked->getNext();
+    imageIndexed->setVal(100);
+    MemoryCell* imageMarked = imageIndexed->getChild()->shiftForward(50);
+    imageMarked->setVal(5);
+    imageMarked->makeFirst();
+#if SPHEREHORN_CELL_BITS >= 32 // these use values which don't fit in narrower cells
+    // a sparse loop
+    MemoryCell* imageSparse = imageIndexed->getNext();
+    imageSparse->setVal(4000000000u);
+    imageSparse->getChild()->shiftForward(3000000000u)->setVal(6);
+#endif
+    // a loop shared with a literal
+    SharedTree* imageTree = SharedTree::create(MemoryCell("AB"));
+    imageRoot.getChild()->shiftForward(3)->share(*imageTree);
+    imageTree->release();
+    // a string
+    imageRoot.getChild()->getPrev()->setLeaves({'x', 'y', 'z'});
+
+    stringstream imageStream;
+    MemoryImage::write(imageStream, imageRoot, imageMarked);
+    MemoryCell* imageMarkedCopy = nullptr;
+    unique_ptr<MemoryCell> imageCopy (MemoryImage::read(imageStream, imageMarkedCopy));
+    assertCopies(imageRoot, *imageCopy);
+    assert(imageCopy->getChild()->getNext()->isIndexed(), == true);
+    assert(imageCopy->getChild()->getPrev()->isPacked(), == true);
+    assert(imageMarkedCopy != nullptr, == true);
+    assert(imageMarkedCopy->getVal(), == 5);
+    assert(imageMarkedCopy->getParent(), == imageCopy->getChild()->getNext());
+    assert(imageMarkedCopy->getParent()->getChild(), == imageMarkedCopy);
+
+    name = "Memory image (malformed)";
+    string imageBytes = imageStream.str();
+    stringstream truncatedStream (imageBytes.substr(0, imageBytes.size() / 2));
+    bool isException = false;
+    try {
+        delete MemoryImage::read(truncatedStream, imageMarkedCopy);
+    } catch (runtime_error& e) {
+        isException = true;
+    }
+    assert(isException,);
+
+    name = "Memory literal";
+    MemoryCell literalRoot (4);
+    literalRoot.getChild()->setVal(2);
+    literalRoot.getChild()->getChild()->setVal(5);
+    MemoryCell* literalMarked = literalRoot.getChild()->shiftForward(2);
+    literalMarked->setLeaves({'a', 'b'});
+    literalRoot.getChild()->getPrev()->setVal(7);
+    stringstream literalStream;
+    MemoryImage::writeLiteral(literalStream, literalRoot, literalMarked);
+    assert(literalStream.str(), == "((5 0) 0\n# memory pointer\n(97 98) 7)\n");
+
+    name = "Memory literal (round trip)";
+    Program literalProg (stringstream("{ break } " + literalStream.str()));
+    stringstream roundTripStream;
+    literalProg.dumpMemory(roundTripStream, false);
+    assert(roundTripStream.str(), == "(\n# memory pointer\n(5 0) 0 (97 98) 7)\n");
+
+    name = "Memory literal (deep)";
+    MemoryCell deepRoot (1);
+    MemoryCell* deepCell = &deepRoot;
+    for (int i = 0; i < 200000; i++) {
+        deepCell = deepCell->getChild();
+        deepCell->setVal(1);
+    }
+    stringstream deepStream;
+    MemoryImage::writeLiteral(deepStream, deepRoot, nullptr);
+    string deepLiteral = deepStream.str();
+    assert(std::count(deepLiteral.begin(), deepLiteral.end(), '('), == 200000);
+    assert(std::count(deepLiteral.begin(), deepLiteral.end(), ')'), == 200000);
+
+    name = "Suspending blocks";
+    ProgramState state;
+    resetState(state);
+    auto inc1 = instr_ptr(new Instructions::Increment(Condition::ALWAYS));
+    auto inc2 = instr_ptr(new Instructions::Increment(Condition::ALWAYS));
+    auto break1 = instr_ptr(new Instructions::Break(Condition::ALWAYS));
+    instr_ptr inner (new InstructionBlock());
+    static_cast<InstructionBlock&>(*inner).insertInstr(inc2);
+    static_cast<InstructionBlock&>(*inner).insertInstr(break1);
+    InstructionBlock outer;
+    outer.insertInstr(inc1);
+    outer.insertInstr(inner);
+    state.untilCheckpoint = 2;
+    assert(outer.run(state), == Status::SUSPEND);
+    assert(state.accRegister, == 12);
+    assert(state.position == vector<unsigned int>({1, 1}), == true);
+    assert(outer.isValidPosition(state.position), == true);
+    assert(outer.isValidPosition({0, 1}), == false);
+    assert(outer.isValidPosition({1, 2}), == false);
+
+    name = "Resuming blocks";
+    state.untilCheckpoint = 3;
+    assert(outer.action(state), == Status::SUSPEND);
+    assert(state.accRegister, == 14);
+    assert(state.position == vector<unsigned int>({1, 1}), == true);
+    state.position.clear();
+    state.untilCheckpoint = UINT64_MAX;
+
+    const char* counter = "{ numin > { .a numout > chout > >= m; break? > ++ } break } (0 0 '\\n')";
+
+    name = "Checkpoint interval";
+    toCin.str("12\n");
+    fromCout.str("");
+    stringstream intervalInput (counter);
+    Program intervalProg (std::move(intervalInput));
+    intervalProg.enableCheckpoints("", 5);
+    assert(intervalProg.run(), == Status::EXIT);
+    assert(fromCout.str(), == "0\n1\n2\n3\n4\n5\n6\n7\n8\n9\n10\n11\n12\n");
+
+    name = "Restoring programs";
+    ProgramState saved;
+    MemoryCell savedMemory (1);
+    savedMemory.setVal(3);
+    savedMemory.getChild()->setVal(8);
+    savedMemory.getChild()->getPrev()->setVal('\n');
+    saved.accRegister = 5;
+    saved.memoryPtr = savedMemory.getChild()->getNext();
+    saved.position = {2, 0};
+    stringstream checkpointStream;
+    Checkpoint::save(checkpointStream, saved, &savedMemory);
+    fromCout.str("");
+    stringstream restoredInput (counter);
+    Program restoredProg (std::move(restoredInput));
+    restoredProg.restore(checkpointStream);
+    assert(restoredProg.run(), == Status::EXIT);
+    assert(fromCout.str(), == "5\n6\n7\n8\n");
+
+    name = "Restoring programs (mismatch)";
+    saved.position = {2, 9};
+    stringstream mismatchStream;
+    Checkpoint::save(mismatchStream, saved, &savedMemory);
+    stringstream mismatchInput (counter);
+    Program mismatchProg (std::move(mismatchInput));
+    isException = false;
+    try {
+        mismatchProg.restore(mismatchStream);
+    } catch (runtime_error& e) {
+        isException = true;
+    }
+    assert(isException,);
+
+    name = "Restoring programs (malformed memory)";
+    saved.position = {2, 0};
+    // no memory at all, a memory pointer which is missing, and one which is on the root
+    for (int i = 0; i < 3; i++) {
+        saved.memoryPtr = i == 2 ? &savedMemory : i == 1 ? nullptr : savedMemory.getChild();
+        stringstream malformedStream;
+        Checkpoint::save(malformedStream, saved, i == 0 ? nullptr : &savedMemory);
+        ProgramState malformedState;
+        isException = false;
+        try {
+            delete Checkpoint::load(malformedStream, malformedState);
+        } catch (runtime_error& e) {
+            isException = true;
+        }
+        assert(isException,);
+    }
+
+    endGroup();
+}
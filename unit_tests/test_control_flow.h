@@ -6,6 +6,7 @@
 #include "../src/program_state.h"
 #include "../src/memory_cell.h"
 #include "../src/instruction_block.h"
+#include "../src/instruction_node.h"
 #include "../src/instructions/instructions.h"
 #include "unit_tests.h"
 using namespace spherehorn;
@@ -67,6 +68,52 @@ void testControlFlow() {
     assert(state.condRegister, == true);
     assert(state.accRegister, == 5);
 
+    name = "Specialized nodes";
+    MemoryCell nodeCell (1);
+    resetState(state, nodeCell);
+    nodeCell.setVal(3);
+    state.condRegister = true;
+    Instructions::Add addConst (Condition::ALWAYS, createConstArg(2));
+    Instructions::Add addAcc (Condition::WHEN_TRUE, arg_ptr(new Arguments::Accumulator()));
+    Instructions::Add addMem (Condition::WHEN_FALSE, arg_ptr(new Arguments::MemoryCell()));
+    InstructionNode constNode = addConst.node();
+    InstructionNode accNode = addAcc.node();
+    InstructionNode memNode = addMem.node();
+    assert(constNode.value, == 2);
+    assert(constNode.instruction == nullptr, == true);
+    assert(constNode.run(constNode, state), == Status::OKAY);
+    assert(state.accRegister, == 12);
+    assert(accNode.run(accNode, state), == Status::OKAY);
+    assert(state.accRegister, == 24);
+    // skipped, as the condition is true
+    assert(memNode.run(memNode, state), == Status::OKAY);
+    assert(state.accRegister, == 24);
+    state.condRegister = false;
+    assert(accNode.run(accNode, state), == Status::OKAY);
+    assert(state.accRegister, == 24);
+    assert(memNode.run(memNode, state), == Status::OKAY);
+    assert(state.accRegister, == 27);
+    Instructions::Decrement decNode (Condition::ALWAYS);
+    InstructionNode errorNode = decNode.node();
+    state.accRegister = 0;
+    fromCerr.str("");
+    assert(errorNode.run(errorNode, state), == Status::ABORT);
+    assert(fromCerr.str(), == "Error: Attempted decrement past zero\n");
+
+#if SPHEREHORN_CELL_BITS >= 32 // these use values which don't fit in narrower cells
+    name = "Memory limit";
+    resetState(state);
+    MemoryCell limitCell (1000000);
+    state.memoryPtr = limitCell.getChild();
+    auto next1 = instr_ptr(new Instructions::MemoryNext(Condition::ALWAYS));
+    InstructionBlock limitBlock;
+    limitBlock.insertInstr(next1);
+    MemoryCell::pool().setLimit(MemoryCell::pool().numLive() + 100);
+    assert(limitBlock.run(state), == Status::ABORT);
+    assert(limitCell.numChildrenInstantiated, == 102);
+    MemoryCell::pool().setLimit(SIZE_MAX);
+#endif
+
     endGroup();
 }
 
@@ -39,22 +39,40 @@ void testIOInstructions() {
     fromCout.str("");
     assertOkay(chout);
     assert(fromCout.str(), == "\n");
+#if SPHEREHORN_CELL_BITS >= 32 // these use values which don't fit in narrower cells
     cell.setVal(999999); // not valid ASCII
     assertAbort(chout);
+#endif
 
     name = "Input Num";
     resetState(state, cell);
     Instructions::InputNum numin(Condition::ALWAYS);
-    toCin.str("345\n");
+    toCin.str("234\n");
     assertOkay(numin);
-    assert(cell.getVal(), == 345);
+    assert(cell.getVal(), == 234);
     assert(cin.get(), == '\n');
+    // numbers which don't fit in a cell are an error rather than being cut down to size
+    toCin.str("123456789012345678901234567890\n");
+    assertAbort(numin);
+    assert(cell.getVal(), == 234);
+    cin.clear();
+    fromCerr.str("");
+#if SPHEREHORN_CELL_BITS == 8
+    toCin.str("300\n");
+    assertAbort(numin);
+    assert(cell.getVal(), == 234);
+    fromCerr.str("");
+    toCin.str("255\n");
+    assertOkay(numin);
+    assert(cell.getVal(), == 255);
+    cell.setVal(234);
+#endif
 
     name = "Output Num";
     fromCout.str("");
     Instructions::OutputNum numout(Condition::ALWAYS);
     assertOkay(numout);
-    assert(fromCout.str(), == "345");
+    assert(fromCout.str(), == "234");
 
     name = "Input String";
     resetState(state, cell);
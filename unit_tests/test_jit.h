@@ -0,0 +1,115 @@
+// test_jit.h
+
+#pragma once
+
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include "../src/program_state.h"
+#include "../src/memory_cell.h"
+#include "../src/bytecode.h"
+#include "../src/jit.h"
+#include "../src/instruction_block.h"
+#include "../src/instructions/instructions.h"
+#include "../src/program.h"
+#include "unit_tests.h"
+using namespace spherehorn;
+using namespace std;
+
+void testJit() {
+    startGroup("Testing native code");
+
+    // native code isn't always supported, in which case only falling back to bytecode is tested
+    name = "Native code (unsupported)";
+    if (!Jit::isSupported()) {
+        bool isException = false;
+        try {
+            Program unsupportedProg (stringstream("{ ++ break } (0)"));
+            unsupportedProg.compile(Jit::Mode::ON);
+        } catch (runtime_error& e) {
+            isException = true;
+        }
+        assert(isException,);
+        Program autoProg (stringstream("{ ++ break } (0)"));
+        autoProg.compile(Jit::Mode::AUTO);
+        assert(autoProg.run(), == Status::EXIT);
+        endGroup();
+        return;
+    }
+
+    const char* counter = "{ numin > { .a numout > chout > >= m; break? > ++ } break } (0 0 '\\n')";
+
+    name = "Running native code";
+    toCin.str("3\n");
+    fromCout.str("");
+    Program counterProg (stringstream{counter});
+    counterProg.compile(Jit::Mode::ON);
+    assert(counterProg.run(), == Status::EXIT);
+    assert(fromCout.str(), == "0\n1\n2\n3\n");
+
+    name = "Running native code (arithmetic)";
+    fromCout.str("");
+    Program mathProg (stringstream(
+        "{ A 100 - 7 * m r- 1000 / 6 + a % 7 r% 100 .a numout"
+        "  >= 5 and 1 or 0 xor m not { ? A 3 break } << 4 C a { ? .a numout break } break } (2)"));
+    mathProg.compile(Jit::Mode::ON);
+    assert(mathProg.run(), == Status::EXIT);
+    // 100-7=93, *2=186, 1000-186=814, /6=135, +135=270, %7=4, 100%4=0
+    assert(fromCout.str(), == "03");
+
+    name = "Running native code (errors)";
+    fromCerr.str("");
+    Program errorProg (stringstream("{ ++ -- -- } (0)"));
+    errorProg.compile(Jit::Mode::ON);
+    assert(errorProg.run(), == Status::ABORT);
+    assert(fromCerr.str(), == "Error: Attempted decrement past zero\n");
+    fromCerr.str("");
+    Program divProg (stringstream("{ A 5 / m } (0)"));
+    divProg.compile(Jit::Mode::ON);
+    assert(divProg.run(), == Status::ABORT);
+    assert(fromCerr.str(), == "Error: Attempted to perform DIV by zero ( 5 / 0 )\n");
+
+    name = "Suspending native code";
+    // the same program as "Suspending bytecode" in test_bytecode.h, which should stop at the same points
+    ProgramState state;
+    resetState(state);
+    auto inc1 = instr_ptr(new Instructions::Increment(Condition::ALWAYS));
+    auto inc2 = instr_ptr(new Instructions::Increment(Condition::ALWAYS));
+    auto break1 = instr_ptr(new Instructions::Break(Condition::ALWAYS));
+    instr_ptr inner (new InstructionBlock());
+    static_cast<InstructionBlock&>(*inner).insertInstr(inc2);
+    static_cast<InstructionBlock&>(*inner).insertInstr(break1);
+    InstructionBlock outer;
+    outer.insertInstr(inc1);
+    outer.insertInstr(inner);
+    Bytecode suspending (outer);
+    Jit native (suspending);
+    state.untilCheckpoint = 2;
+    assert(native.run(state), == Status::SUSPEND);
+    assert(state.accRegister, == 12);
+    assert(state.position == vector<unsigned int>({1, 1}), == true);
+    state.untilCheckpoint = 3;
+    assert(native.run(state), == Status::SUSPEND);
+    assert(state.accRegister, == 14);
+    assert(state.position == vector<unsigned int>({1, 1}), == true);
+
+    name = "Suspending native code (resuming bytecode)";
+    state.untilCheckpoint = 3;
+    assert(suspending.run(state), == Status::SUSPEND);
+    assert(state.accRegister, == 16);
+    assert(state.position == vector<unsigned int>({1, 1}), == true);
+    state.position.clear();
+    state.untilCheckpoint = UINT64_MAX;
+
+    name = "Checkpoint interval (native code)";
+    toCin.str("12\n");
+    fromCout.str("");
+    Program intervalProg (stringstream{counter});
+    intervalProg.compile(Jit::Mode::ON);
+    intervalProg.enableCheckpoints("", 5);
+    assert(intervalProg.run(), == Status::EXIT);
+    assert(fromCout.str(), == "0\n1\n2\n3\n4\n5\n6\n7\n8\n9\n10\n11\n12\n");
+
+    endGroup();
+}
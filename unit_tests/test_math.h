@@ -74,6 +74,12 @@ void testMathInstructions() {
     Instructions::Multiply mul(Condition::ALWAYS, arg);
     assertOkay(mul);
     assertAccEq(30);
+    // this wraps around whatever the width of num is
+    state.accRegister = num(-1);
+    arg = createConstArg(num(-1));
+    Instructions::Multiply mul2(Condition::ALWAYS, arg);
+    assertOkay(mul2);
+    assertAccEq(1);
 
     name = "Divide";
     resetState(state);
@@ -2,8 +2,10 @@
 
 #pragma once
 
+#include <functional>
 #include <string>
 #include <utility>
+#include <vector>
 #include "unit_tests.h"
 using namespace spherehorn;
 using namespace std;
@@ -49,6 +51,30 @@ void testMemoryCell() {
     }
     assert(topCell.numChildrenInstantiated, == 5);
 
+#if SPHEREHORN_CELL_BITS >= 32 // these use values which don't fit in narrower cells
+    name = "Loop ends";
+    MemoryCell wideParent (1000);
+    MemoryCell* wideFirst = wideParent.getChild();
+    // the ends of the segment are linked to each other across the uninstantiated children
+    assert(wideFirst->prevSibling, == wideFirst);
+    assert(wideFirst->nextSibling, == wideFirst);
+    assert(wideFirst->isGapBefore() && wideFirst->isGapAfter(), == true);
+    MemoryCell* wideLast = wideFirst->getPrev();
+    MemoryCell* wideCurr = wideFirst;
+    for (int i = 0; i < 997; i++) {
+        wideCurr = wideCurr->getNext();
+    }
+    assert(wideCurr->nextSibling, == wideLast);
+    assert(wideLast->prevSibling, == wideCurr);
+    assert(wideCurr->isGapAfter() && wideLast->isGapBefore(), == true);
+    assert(wideFirst->isGapBefore() || wideFirst->isGapAfter(), == false);
+    MemoryCell* wideClosing = wideCurr->getNext();
+    assert(wideParent.isFull(), == true);
+    assert(wideClosing->getNext(), == wideLast);
+    assert(wideLast->getPrev(), == wideClosing);
+    assert(wideClosing->isGapAfter() || wideLast->isGapBefore() || wideCurr->isGapAfter(), == false);
+#endif
+
     name = "Shift multiple positions";
     assert(childCell->shiftBack(5), == childCell);
     assert(childCell->shiftForward(10), == childCell);
@@ -166,6 +192,304 @@ void testMemoryCell() {
     assert(toGrandchildB1.getParent(), == &moveChild1);
     assert(toGrandchildB2.getParent(), == &moveChild1);
 
+    name = "Indexed layout (switch)";
+    MemoryCell indexParent (100);
+    MemoryCell* indexFirst = indexParent.getChild();
+    indexFirst->setVal(1);
+    indexFirst->getNext()->setVal(2);
+    indexFirst->getPrev()->setVal(3);
+    assert(indexParent.isIndexed(), == false);
+    std::size_t indexBytesBefore = MemoryCell::pool().numBytes();
+    MemoryCell* indexFar = indexFirst->shiftForward(50);
+    assert(indexParent.isIndexed(), == true);
+    assert(indexParent.numChildrenInstantiated, == 4);
+    // so few of the children have been instantiated that only they are indexed, but the index still
+    // counts towards the pool's memory, as well as the one new cell
+    assert(indexParent.childIndex->isSparse(), == true);
+    assert(MemoryCell::pool().numBytes() > indexBytesBefore + sizeof(MemoryCell), == true);
+    assert(indexFirst->getNext()->getVal(), == 2);
+    assert(indexFirst->getPrev()->getVal(), == 3);
+    assert(indexFar->shiftBack(50), == indexFirst);
+    assert(indexFar->shiftForward(150), == indexFirst);
+    assert(indexFirst->shiftBack(1), == indexFirst->getPrev());
+    assert(indexParent.numChildrenInstantiated, == 4);
+
+    name = "Indexed layout (density)";
+    MemoryCell densityParent (200);
+    MemoryCell* densityFirst = densityParent.getChild();
+    MemoryCell* densityFar = densityFirst->shiftForward(100);
+    assert(densityParent.childIndex->isSparse(), == true);
+    std::size_t densityBytesBefore = MemoryCell::pool().numBytes();
+    MemoryCell* densityCurr = densityFirst;
+    for (int i = 0; i < 60; i++) densityCurr = densityCurr->getNext();
+    // a quarter of the loop has been instantiated now, so the index has room for all of it
+    assert(densityParent.childIndex->isSparse(), == false);
+    assert(MemoryCell::pool().numBytes() >= densityBytesBefore + 200 * sizeof(CellLink), == true);
+    assert(densityFirst->shiftForward(60), == densityCurr);
+    assert(densityCurr->shiftForward(40), == densityFar);
+    assert(densityFar->shiftBack(100), == densityFirst);
+    MemoryCell densityCopy (densityParent);
+    assertCopies(densityParent, densityCopy);
+
+    name = "Indexed layout (rotate)";
+    indexFar->makeFirst();
+    assert(indexParent.getChild(), == indexFar);
+    indexFirst->makeFirst();
+    assert(indexParent.getChild(), == indexFirst);
+
+    name = "Indexed layout (insert)";
+    MemoryCell* indexBefore = indexFirst->insertBefore(4);
+    MemoryCell* indexAfter = indexFirst->insertAfter(5);
+    assert(indexParent.getVal(), == 102);
+    assert(indexParent.numChildrenInstantiated, == 6);
+    assert(indexParent.getChild(), == indexFirst);
+    assert(indexFirst->getPrev(), == indexBefore);
+    assert(indexBefore->getPrev()->getVal(), == 3);
+    assert(indexFirst->getNext(), == indexAfter);
+    assert(indexAfter->getNext()->getVal(), == 2);
+    assert(indexBefore->getParent(), == &indexParent);
+    assert(indexFirst->shiftForward(51), == indexFar);
+
+    name = "Indexed layout (delete)";
+    assert(indexBefore->deleteAfter(), == indexFirst);
+    assert(indexAfter->deleteBefore(), == indexFirst);
+    assert(indexParent.getVal(), == 100);
+    assert(indexParent.numChildrenInstantiated, == 4);
+    assert(indexFirst->getPrev()->getVal(), == 3);
+    assert(indexFirst->getNext()->getVal(), == 2);
+    MemoryCell* indexNewFirst = indexFirst->deleteAfter();
+    assert(indexParent.getChild(), == indexNewFirst);
+    assert(indexNewFirst->getVal(), == 2);
+    assert(indexParent.getVal(), == 99);
+
+    name = "Indexed layout (copy)";
+    MemoryCell indexCopy (indexParent);
+    assertCopies(indexParent, indexCopy);
+    MemoryCell indexMoved (std::move(indexCopy));
+    assert(indexMoved.getChild()->getParent(), == &indexMoved);
+    assertCopies(indexParent, indexMoved);
+    indexMoved.setVal(3);
+    assert(indexMoved.isIndexed(), == false);
+
+    name = "Deep trees";
+    MemoryCell* deepRoot = new MemoryCell(1);
+    MemoryCell* deepCurr = deepRoot;
+    for (int i = 0; i < 1000000; i++) {
+        deepCurr->setVal(1);
+        deepCurr = deepCurr->getChild();
+    }
+    deepCurr->setVal(7);
+    MemoryCell* deepCopy = new MemoryCell(*deepRoot);
+    delete deepRoot;
+    deepCurr = deepCopy;
+    for (int i = 0; i < 1000000; i++) {
+        deepCurr = deepCurr->getChild();
+    }
+    assert(deepCurr->getVal(), == 7);
+    delete deepCopy;
+
+#if SPHEREHORN_CELL_BITS >= 32 // these use values which don't fit in narrower cells
+    name = "Deferred reclamation";
+    MemoryCell::setDeferredReclamation(true);
+    MemoryCell* discardRoot = new MemoryCell(1000);
+    MemoryCell* discardCurr = discardRoot->getChild();
+    discardCurr->setVal(2);
+    discardCurr->getChild()->getNext();
+    for (int i = 0; i < 200; i++) {
+        discardCurr = discardCurr->getNext();
+    }
+    discardCurr->shiftForward(500)->setVal(3);
+    discardRoot->setVal(0);
+    assert(discardRoot->numChildrenInstantiated, == 0);
+    assert(MemoryCell::garbage.size(), == 1);
+    MemoryCell::reclaimSome();
+    assert(MemoryCell::hasGarbage(), == true);
+    MemoryCell::reclaimAll();
+    assert(MemoryCell::hasGarbage(), == false);
+    delete discardRoot;
+    MemoryCell::setDeferredReclamation(false);
+#endif
+
+    name = "Shared trees";
+    MemoryCell literal ("AB");
+    literal.getChild()->getChild()->setVal(3);
+    SharedTree* tree = SharedTree::create(std::move(literal));
+    MemoryCell sharer1;
+    MemoryCell sharer2;
+    sharer1.share(*tree);
+    sharer2 = sharer1;
+    assert(sharer1.isShared(), == true);
+    assert(sharer2.isShared(), == true);
+    assert(sharer1.getVal(), == 2);
+    assert(tree->numRefs_, == 3);
+    MemoryCell* sharedA = sharer1.getChild();
+    assert(sharer1.isShared(), == false);
+    assert(sharedA->isShared(), == true);
+    assert(sharedA->getNext()->isShared(), == false);
+    assert(sharedA->getVal(), == 'A');
+    assert(tree->numRefs_, == 3);
+    sharedA->getChild()->setVal(4);
+    assert(tree->root().firstChild->firstChild->getVal(), == 3);
+    assert(tree->numRefs_, == 2);
+    tree->release();
+    assert(sharer2.getChild()->getChild()->getVal(), == 3);
+
+#if SPHEREHORN_CELL_BITS >= 32 // these use values which don't fit in narrower cells
+    name = "Sparse layout";
+    MemoryCell sparseParent (4000000000u);
+    MemoryCell* sparseFirst = sparseParent.getChild();
+    std::size_t sparseBytesBefore = MemoryCell::pool().numBytes();
+    MemoryCell* sparseFar = sparseFirst->shiftForward(3000000000u);
+    assert(sparseParent.childIndex->isSparse(), == true);
+    // the index only holds the instantiated children, rather than a slot for each of billions
+    assert(MemoryCell::pool().numBytes() < sparseBytesBefore + 1000 * sizeof(CellLink), == true);
+    assert(sparseParent.numChildrenInstantiated, == 2);
+    assert(sparseFar->shiftBack(3000000000u), == sparseFirst);
+    assert(sparseFirst->getPrev()->shiftBack(999999999u), == sparseFar);
+    assert(sparseParent.numChildrenInstantiated, == 3);
+    MemoryCell* sparseInserted = sparseFar->insertBefore(7);
+    assert(sparseFirst->shiftForward(3000000001u), == sparseFar);
+    assert(sparseFar->getPrev(), == sparseInserted);
+    assert(sparseFar->deleteBefore(), == sparseInserted);
+    assert(sparseParent.getVal(), == 4000000000u);
+    assert(sparseParent.numChildrenInstantiated, == 3);
+    assert(sparseFirst->shiftForward(3000000000u), == sparseInserted);
+    MemoryCell sparseCopy (sparseParent);
+    assertCopies(sparseParent, sparseCopy);
+
+    name = "Sparse edits";
+    MemoryCell sparseEdited (3000000000u);
+    MemoryCell* sparseStart = sparseEdited.getChild();
+    std::vector<MemoryCell*> spread {sparseStart};
+    for (int i = 1; i < 200; i++) spread.push_back(spread.back()->shiftForward(10000000u));
+    // insert before every third child and delete after every fourth, so every later child moves
+    // by a different amount
+    for (std::size_t i = 1; i < spread.size(); i += 3) spread[i]->insertBefore();
+    for (std::size_t i = 1; i < spread.size(); i += 4) spread[i]->deleteAfter();
+    num expectedPos = 0;
+    for (std::size_t i = 1; i < spread.size(); i++) {
+        expectedPos += 10000000u + (i % 3 == 1) - ((i - 1) % 4 == 1);
+        assert(sparseStart->shiftForward(expectedPos), == spread[i]);
+        assert(sparseEdited.childIndex->positionOf(spread[i]), == expectedPos);
+    }
+    assert(sparseEdited.getVal(), == 3000000000u + 67 - 50);
+    assert(sparseEdited.numChildrenInstantiated, == 200u + 67);
+    MemoryCell sparseEditedCopy (sparseEdited);
+    assertCopies(sparseEdited, sparseEditedCopy);
+#endif
+
+    name = "Packed layout";
+    std::size_t packedLiveBefore = MemoryCell::pool().numLive();
+    std::size_t packedBytesBefore = MemoryCell::pool().numBytes();
+    MemoryCell packed ("hello");
+    assert(packed.isPacked(), == true);
+    assert(packed.getVal(), == 5);
+    assert(MemoryCell::pool().numLive(), == packedLiveBefore);
+    // the leaves aren't cells, but they still count towards the pool's memory
+    assert(MemoryCell::pool().numBytes(), == packedBytesBefore + packed.leaves->numBytes());
+    assert(packed.getLeaves()->at(1), == 'e');
+    MemoryCell packedCopy (packed);
+    assert(packedCopy.isPacked(), == true);
+    assertCopies(packed, packedCopy);
+    MemoryCell packedMoved (std::move(packedCopy));
+    assert(packedMoved.isPacked(), == true);
+    assert(packedCopy.isPacked(), == false);
+    MemoryCell* packedFirst = packedMoved.getChild();
+    assert(packedMoved.isPacked(), == false);
+    assert(packedMoved.getLeaves(), == nullptr);
+    assert(packedFirst->getVal(), == 'h');
+    assert(packedFirst->getPrev()->getVal(), == 'o');
+    assert(packedFirst->shiftForward(5), == packedFirst);
+    assertCopies(packed, packedMoved);
+    packed.setLeaves({1, 2, 3});
+    assert(packed.getVal(), == 3);
+    assert(packed.getChild()->getNext()->getVal(), == 2);
+    SharedTree* packedTree = SharedTree::create(MemoryCell("ab"));
+    MemoryCell packedSharer;
+    packedSharer.share(*packedTree);
+    packedTree->release();
+    assert(packedSharer.isShared(), == true);
+    assert(packedSharer.getLeaves()->at(0), == 'a');
+
+    name = "Adaptive layout (unindexing)";
+    MemoryCell adaptive (20);
+    MemoryCell* adaptiveCell = adaptive.getChild()->shiftForward(10);
+    assert(adaptive.isIndexed(), == true);
+    for (int i = 0; i < 20; i++) adaptiveCell = adaptiveCell->getNext();
+    // lots of edits without long shifts in between take it back out of the index
+    for (num i = 0; i < 16; i++) adaptiveCell->insertAfter(i);
+    assert(adaptive.isIndexed(), == false);
+    assert(adaptive.getVal(), == 36);
+    assert(adaptiveCell->getNext()->getVal(), == 15);
+    assert(adaptive.getChild()->getPrev()->getVal(), == 0);
+    // and it takes more than one long shift to put it back in
+    adaptiveCell = adaptiveCell->shiftForward(8);
+    assert(adaptive.isIndexed(), == false);
+    for (int i = 0; i < 3; i++) adaptiveCell = adaptiveCell->shiftForward(8);
+    assert(adaptive.isIndexed(), == true);
+    assert(adaptiveCell, == adaptive.getChild()->shiftForward(42));
+
+    name = "Adaptive layout (packing)";
+    MemoryCell packable (20);
+    MemoryCell* packableChild = packable.getChild();
+    for (num i = 0; i < 20; i++) {
+        packableChild->setVal(i);
+        packableChild = packableChild->getNext();
+    }
+    MemoryCell packableCopy (packable);
+    assert(packableChild->ascend(), == &packable);
+    assert(packable.isPacked(), == true);
+    assert(packable.numChildrenInstantiated, == 20);
+    assertCopies(packable, packableCopy);
+    // once something has needed them to be cells, they stay that way
+    packableChild = packable.getChild();
+    assert(packableChild->ascend(), == &packable);
+    assert(packable.isPacked(), == false);
+    assertCopies(packable, packableCopy);
+    // and loops which aren't just leaves are never packed
+    packableCopy.getChild()->setVal(1);
+    packableCopy.getChild()->getChild();
+    assert(packableCopy.getChild()->getNext()->ascend(), == &packableCopy);
+    assert(packableCopy.isPacked(), == false);
+
+    name = "Compaction";
+    MemoryCell scattered (40);
+    // inserting and deleting leaves the children wherever the pool had room
+    MemoryCell* scatteredCell = scattered.getChild();
+    vector<MemoryCell*> unrelated;
+    for (num i = 0; i < 30; i++) {
+        scatteredCell = scatteredCell->insertAfter(i);
+        unrelated.push_back(new MemoryCell(i));
+        if (i % 3 == 0) scatteredCell = scatteredCell->deleteBefore();
+    }
+    for (MemoryCell* cell : unrelated) delete cell;
+    scatteredCell->setVal(3);
+    scatteredCell->getChild()->setVal(7);
+    scatteredCell->getNext()->setLeaves({1, 2});
+    MemoryCell* scatteredIndexed = scatteredCell->getPrev();
+    scatteredIndexed->setVal(50);
+    scatteredIndexed->getChild()->shiftForward(20)->setVal(9);
+    scattered.getChild()->shiftBack(10)->setVal(4);
+    MemoryCell* walker = scattered.getChild();
+    for (num i = 0; i < scattered.getVal(); i++) walker = walker->getNext();
+    MemoryCell scatteredCopy (scattered);
+    MemoryCell* tracked = scatteredIndexed->getChild()->shiftForward(20);
+    std::size_t liveBefore = MemoryCell::pool().numLive();
+    MemoryCell::compact(scattered, tracked);
+    assertCopies(scattered, scatteredCopy);
+    assert(MemoryCell::pool().numLive(), == liveBefore);
+    assert(tracked->getVal(), == 9);
+    assert(tracked->getParent()->getParent(), == &scattered);
+    // the children of each loop are next to each other in memory, in order
+    MemoryCell* compacted = scattered.getChild();
+    bool isInOrder = true;
+    for (num i = 1; i < scattered.getVal(); i++) {
+        MemoryCell* next = compacted->getNext();
+        if (!std::less<MemoryCell*>()(compacted, next)) isInOrder = false;
+        compacted = next;
+    }
+    assert(isInOrder, == true);
+
     endGroup();
 }
 
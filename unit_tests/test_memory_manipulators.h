@@ -3,6 +3,7 @@
 #include "../src/program_state.h"
 #include "../src/memory_cell.h"
 #include "../src/instructions/instructions.h"
+#include "../src/literal_pool.h"
 #include "unit_tests.h"
 
 void testMemoryManipulatorInstructions() {
@@ -260,6 +261,74 @@ void testMemoryManipulatorInstructions() {
         assert(delChild->numChildrenInstantiated, == 0);
     }
 
+    {
+        name = "Delete Before/After (uninstantiated neighbors)";
+        Instructions::DeleteBefore delbefore (Condition::ALWAYS);
+        Instructions::DeleteAfter  delafter  (Condition::ALWAYS);
+        // consuming a queue from one end shouldn't allocate anything
+        MemoryCell queue (10);
+        MemoryCell* head = queue.getChild();
+        head->setVal(1);
+        head->getChild();
+        std::size_t numLive = MemoryCell::pool().numLive();
+        resetState(state, *head);
+        for (int i = 0; i < 5; i++) assertOkay(delafter);
+        assert(state.memoryPtr, == head);
+        assert(head->getVal(), == 0);
+        assert(queue.getVal(), == 5);
+        assert(queue.numChildrenInstantiated, == 1);
+        assert(MemoryCell::pool().numLive() + 1, == numLive);
+
+        // the neighbor on the other side is left alone
+        MemoryCell* next = head->getNext();
+        resetState(state, *head);
+        assertOkay(delafter);
+        assert(state.memoryPtr, == next);
+        assert(next->isGapBefore(), == true);
+        assert(queue.getChild(), == next);
+        assert(queue.numChildrenInstantiated, == 1);
+        assert(queue.getVal(), == 4);
+
+        // until the loop is full
+        next->getNext();
+        next->getNext()->getNext();
+        resetState(state, *next);
+        assertOkay(delbefore);
+        assert(state.memoryPtr, == next);
+        assert(queue.getVal(), == 3);
+        assert(queue.isFull(), == true);
+        assert(next->getPrev()->getPrev()->getPrev(), == next);
+
+        MemoryCell indexed (100);
+        MemoryCell* indexedFirst = indexed.getChild();
+        indexed.buildIndex();
+        numLive = MemoryCell::pool().numLive();
+        resetState(state, *indexedFirst);
+        assertOkay(delbefore);
+        assertOkay(delbefore);
+        assert(state.memoryPtr, == indexedFirst);
+        assert(indexed.getVal(), == 98);
+        assert(indexed.getChild(), == indexedFirst);
+        assert(MemoryCell::pool().numLive(), == numLive);
+        MemoryCell* indexedNext = indexedFirst->getNext();
+        assertOkay(delafter);
+        assert(state.memoryPtr, == indexedNext);
+        assert(indexed.getChild(), == indexedNext);
+        assert(indexed.numChildrenInstantiated, == 1);
+#if SPHEREHORN_CELL_BITS >= 32 // these use values which don't fit in narrower cells
+
+        MemoryCell sparse (2000000);
+        MemoryCell* sparseFirst = sparse.getChild();
+        sparse.buildIndex();
+        resetState(state, *sparseFirst);
+        assertOkay(delbefore);
+        assert(state.memoryPtr, == sparseFirst);
+        assert(sparse.getVal(), == 1999999);
+        assert(sparse.numChildrenInstantiated, == 1);
+        assert(sparse.getChild(), == sparseFirst);
+#endif
+    }
+
     {
         name = "Memory setter";
         resetState(state, cell);
@@ -277,6 +346,59 @@ void testMemoryManipulatorInstructions() {
         assert(childCell3.getParent(), == &cell);
     }
 
+    {
+        name = "Memory setter (interned literals)";
+        LiteralPool pool;
+        SharedTree* internA = pool.intern(MemoryCell("ab"));
+        SharedTree* internB = pool.intern(MemoryCell("ab"));
+        SharedTree* internC = pool.intern(MemoryCell("abc"));
+        assert(internA, == internB);
+        assert(internA != internC, == true);
+        assert(pool.size(), == 2);
+        assert(internA->numRefs_, == 3);
+        pool.clear();
+        assert(internA->numRefs_, == 2);
+        Instructions::SetMemory internSetA (Condition::ALWAYS, internA);
+        Instructions::SetMemory internSetB (Condition::ALWAYS, internB);
+        internC->release();
+        MemoryCell internCell;
+        resetState(state, internCell);
+        assertOkay(internSetB);
+        MemoryCell internExpected ("ab");
+        assertCopies(internCell, internExpected);
+    }
+    {
+        name = "Memory setter (interned subtrees)";
+        LiteralPool pool;
+        MemoryCell outerA;
+        outerA.insertChild(new MemoryCell(1));
+        outerA.insertChild(new MemoryCell("ab"));
+        MemoryCell outerB;
+        outerB.insertChild(new MemoryCell(2));
+        outerB.insertChild(new MemoryCell("ab"));
+        MemoryCell outerExpected (outerA);
+        SharedTree* internA = pool.intern(std::move(outerA));
+        SharedTree* internB = pool.intern(std::move(outerB));
+        // the two literals are different, but the string in them is only stored once
+        assert(internA != internB, == true);
+        assert(pool.size(), == 3);
+        MemoryCell* stringA = internA->root().firstChild->nextSibling;
+        MemoryCell* stringB = internB->root().firstChild->nextSibling;
+        assert(stringA->isShared(), == true);
+        assert(stringA->sharedSource, == stringB->sharedSource);
+        SharedTree* internString = pool.intern(MemoryCell("ab"));
+        assert(internString->root().getLeaves(), == stringA->getLeaves());
+        internString->release();
+        pool.clear();
+        Instructions::SetMemory internSetA (Condition::ALWAYS, internA);
+        internB->release();
+        MemoryCell internCell;
+        resetState(state, internCell);
+        assertOkay(internSetA);
+        assertCopies(internCell, outerExpected);
+        assert(internCell.getChild()->getNext()->getChild()->getVal(), == 'a');
+    }
+
     endGroup();
 }
 
@@ -16,6 +16,7 @@ using namespace spherehorn;
 void testParser() {
     startGroup("Testing the parser");
 
+#if SPHEREHORN_CELL_BITS >= 32 // these use values which don't fit in narrower cells
     {
         name = "Memory block";
         stringstream str (
@@ -54,6 +55,7 @@ void testParser() {
         parent.insertChild(child5);
         assertCopies(*prog.memory_, parent);
     }
+#endif
 
     {
         name = "String concatenation";
@@ -73,6 +75,25 @@ void testParser() {
         assertCopies(*prog.memory_, parent);
     }
 
+    {
+        name = "Memory block (unvisited loops)";
+        stringstream str ("((1 2 3) (0 0 0 0) ((5) 6) 7) { break }");
+        Program prog (std::move(str));
+        assert(prog.isParseError(), == false);
+        // only the top-level loop has been made into cells, since that's where the program starts
+        MemoryCell* leaves = prog.state_.memoryPtr;
+        assert(leaves->isPacked(), == true);
+        MemoryCell* zeros = leaves->getNext();
+        assert(zeros->getVal(), == 4);
+        assert(zeros->numChildrenInstantiated, == 0);
+        MemoryCell* nested = zeros->getNext();
+        assert(nested->isPacked(), == false);
+        assert(nested->getChild()->isPacked(), == true);
+        assert(nested->getChild()->getNext()->getVal(), == 6);
+        assert(leaves->getChild()->getPrev()->getVal(), == 3);
+        assert(leaves->isPacked(), == false);
+    }
+
     {
         name = "Instruction block";
         fromCout.str("");
@@ -123,6 +144,7 @@ void testParser() {
         assert(prog1.isParseError(), == false);
         MemoryCell cell1 ("foobar");
         assertCopies(*prog1.memory_, cell1);
+#if SPHEREHORN_CELL_BITS >= 32 // these use values which don't fit in narrower cells
         stringstream str2 (
             "0xdeadbeef"
             ""
@@ -133,6 +155,7 @@ void testParser() {
         MemoryCell cell2 (0xdeadbeef);
         cell2.getChild();
         assertCopies(*prog2.memory_, cell2);
+#endif
     }
 
     {
@@ -231,6 +254,17 @@ void testParser() {
         assertParseError(prog7);
     }
 
+    {
+        name = "Parse error: integer too large";
+        fromCerr.str("");
+        stringstream str1 (
+            "(0x10000000000000000)"
+            "{break}"
+        );
+        Program prog1 (std::move(str1));
+        assertParseError(prog1);
+    }
+
     endGroup();
 }
 
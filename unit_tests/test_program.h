@@ -1,8 +1,10 @@
 // test_program.h
 
 #include <sstream>
+#include <filesystem>
 #include <fstream>
 #include <stdexcept>
+#include <string>
 #include "unit_tests.h"
 using namespace spherehorn;
 using namespace std;
@@ -56,6 +58,91 @@ void testProgram() {
         displayNotOpenError();
     }
 
+    name = "Loading memory (string)";
+    string loadPath = (filesystem::temp_directory_path() / "spherehorn_test_memory").string();
+    ofstream loadOutput (loadPath, ios::binary);
+    loadOutput << "hi\xff";
+    loadOutput.close();
+    toCin.str("");
+    fromCout.str("");
+    Program loadStringProg (stringstream("{ numout > numout break } (0)"));
+    loadStringProg.loadMemory(loadPath, false);
+    assert(loadStringProg.run(), == Status::EXIT);
+    assert(fromCout.str(), == "104105");
+    stringstream loadDump;
+    loadStringProg.dumpMemory(loadDump, false);
+    assert(loadDump.str(), == "(104\n# memory pointer\n105 255)\n");
+
+    name = "Loading memory (image)";
+    loadOutput.open(loadPath, ios::binary);
+    loadStringProg.dumpMemory(loadOutput, true);
+    loadOutput.close();
+    Program loadImageProg (stringstream("{ break } (0)"));
+    loadImageProg.loadMemory(loadPath, true);
+    stringstream loadImageDump;
+    loadImageProg.dumpMemory(loadImageDump, false);
+    assert(loadImageDump.str(), == "(\n# memory pointer\n104 105 255)\n");
+
+    name = "Loading memory (errors)";
+    loadOutput.open(loadPath, ios::binary);
+    loadOutput << "\x02";
+    loadOutput.close();
+    isException = false;
+    try {
+        loadImageProg.loadMemory(loadPath, true);
+    } catch (runtime_error& e) {
+        isException = true;
+    }
+    assert(isException,);
+    loadOutput.open(loadPath, ios::binary);
+    loadOutput.close();
+    isException = false;
+    try {
+        loadImageProg.loadMemory(loadPath, false);
+    } catch (runtime_error& e) {
+        isException = true;
+    }
+    assert(isException,);
+    // no marked cell, and a root with the value 0
+    loadOutput.open(loadPath, ios::binary);
+    loadOutput << string(3, '\0');
+    loadOutput.close();
+    isException = false;
+    try {
+        loadImageProg.loadMemory(loadPath, true);
+    } catch (runtime_error& e) {
+        isException = true;
+    }
+    assert(isException,);
+    filesystem::remove(loadPath);
+    isException = false;
+    try {
+        loadImageProg.loadMemory(loadPath, false);
+    } catch (runtime_error& e) {
+        isException = true;
+    }
+    assert(isException,);
+
+    name = "Emitting C++";
+    Program emitProg (stringstream("a: 3 { + 2 { ? numout -- break } . \"hi\" >= 7 break! } (1 2)"));
+    stringstream emitted;
+    emitProg.emitCpp(emitted);
+    string code = emitted.str();
+    assert(code.find("num acc = num{3u};") != string::npos,);
+    assert(code.find("        acc += num{2u};\n"
+                     "        if (cond) {\n"
+                     "            while (true) {\n"
+                     "                if (Status result = apply(Instructions::OutputNum::apply); result != Status::OKAY) return exitCode(result);\n"
+                     "                if (acc == 0) return exitCode(apply(Instructions::Decrement::apply));\n"
+                     "                acc--;\n"
+                     "                break;\n"
+                     "            }\n"
+                     "        }\n"
+                     "        memoryPtr->share(*literals[0]);\n"
+                     "        cond = acc >= num{7u};\n"
+                     "        if (!cond) break;\n") != string::npos,);
+    assert(code.find("readLiteral(literalImage0, sizeof(literalImage0))") != string::npos,);
+
     endGroup();
 }
 
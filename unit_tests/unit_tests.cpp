@@ -1,5 +1,6 @@
 // unit_tests.cpp
 
+#include "test_cell_pool.h"
 #include "test_memory_cell.h"
 #include "test_parser.h"
 #include "test_arguments.h"
@@ -11,11 +12,15 @@
 #include "test_control_flow.h"
 #include "test_tokenizer.h"
 #include "test_program.h"
+#include "test_checkpoint.h"
+#include "test_bytecode.h"
+#include "test_jit.h"
 #include "unit_tests.h"
 
 
 int main() {
     replaceStdio();
+    testCellPool();
     testMemoryCell();
     testArguments();
     testMathInstructions();
@@ -27,6 +32,9 @@ int main() {
     testTokenizer();
     testParser();
     testProgram();
+    testCheckpoint();
+    testBytecode();
+    testJit();
     return 0;
 }
 
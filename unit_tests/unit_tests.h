@@ -11,6 +11,8 @@
 #undef private
 #include "../src/program_state.h"
 #include "../src/memory_cell.h"
+#include "../src/child_index.h"
+#include "../src/leaf_vector.h"
 #include "../src/arguments.h"
 #include "../src/instruction_container.h"
 #include "../src/tokenizer.h"
@@ -116,6 +118,9 @@ arg_ptr createConstArg(num x) {
     }
 
 bool areCellsCopies(const spherehorn::MemoryCell& lhs, const spherehorn::MemoryCell& rhs) {
+    // a SHARED cell's children are those of the cell it shares them with
+    if (lhs.isShared()) return areCellsCopies(*lhs.sharedSource, rhs);
+    if (rhs.isShared()) return areCellsCopies(lhs, *rhs.sharedSource);
     // if lhs and rhs have different values or numbers of children, return false
     if (lhs.getVal() != rhs.getVal() || lhs.numChildrenInstantiated != rhs.numChildrenInstantiated)
         return false;
@@ -125,6 +130,34 @@ bool areCellsCopies(const spherehorn::MemoryCell& lhs, const spherehorn::MemoryC
     // if lhs and rhs have the same value and no instantiated children, return true
     if (lhs.getVal() == rhs.getVal() && lhs.numChildrenInstantiated == 0 && rhs.numChildrenInstantiated == 0)
         return true;
+    // PACKED children are just values, which a LINKED cell's leaves can match too
+    if (rhs.isPacked() && !lhs.isPacked()) return areCellsCopies(rhs, lhs);
+    if (lhs.isPacked()) {
+        if (rhs.isPacked()) return *lhs.getLeaves() == *rhs.getLeaves();
+        if (rhs.isIndexed()) return false;
+        const spherehorn::MemoryCell* currRhsChild = rhs.firstChild;
+        for (num leaf : *lhs.getLeaves()) {
+            if (currRhsChild->getVal() != leaf || currRhsChild->numChildrenInstantiated != 0) return false;
+            currRhsChild = currRhsChild->nextSibling;
+        }
+        return true;
+    }
+    // if lhs and rhs are INDEXED, compare their children position by position, starting from the first
+    if (lhs.isIndexed() != rhs.isIndexed()) return false;
+    if (lhs.isIndexed()) {
+        const spherehorn::ChildIndex& lhsIndex = *lhs.childIndex;
+        const spherehorn::ChildIndex& rhsIndex = *rhs.childIndex;
+        // we already know they have the same number of instantiated children, so it's enough to check
+        // that every one of lhs's has a copy in rhs
+        bool copies = true;
+        lhsIndex.forEach([&](num pos, spherehorn::MemoryCell* lhsChild) {
+            num offset = lhsIndex.back(pos, lhsIndex.first());
+            spherehorn::MemoryCell* rhsChild = rhsIndex.at(rhsIndex.forward(rhsIndex.first(), offset));
+            if (!rhsChild || !areCellsCopies(*lhsChild, *rhsChild)) copies = false;
+            else if (lhsChild->getParent() != &lhs || rhsChild->getParent() != &rhs) copies = false;
+        });
+        return copies;
+    }
 
     // check whether the first children are copies
     spherehorn::MemoryCell* currLhsChild = lhs.firstChild;
@@ -133,30 +166,21 @@ bool areCellsCopies(const spherehorn::MemoryCell& lhs, const spherehorn::MemoryC
     if (!areCellsCopies(*currLhsChild, *currRhsChild)) return false;
     // ensure parents are set correctly
     if (currLhsChild->getParent() != &lhs || currRhsChild->getParent() != &rhs) return false;
-    // iterate forwards over lhs and rhs's children, starting from the second child
-    for (currLhsChild = lhs.firstChild->nextSibling, currRhsChild = rhs.firstChild->nextSibling;
-         // currLhsChild & currRhsChild aren't null and we haven't looped around
-         currLhsChild && currRhsChild && currLhsChild != lhs.firstChild;
-         currLhsChild = currLhsChild->nextSibling, currRhsChild = currRhsChild->nextSibling) {
-        // recursive call
-        if (!areCellsCopies(*currLhsChild, *currRhsChild)) return false;
-        // ensure parents are set correctly
-        if (currLhsChild->getParent() != &lhs || currRhsChild->getParent() != &rhs) return false;
-    }
-    // if one of them is null and the other isn't, return false
-    if ((currLhsChild && !currRhsChild) || (!currLhsChild && currRhsChild)) return false;
-    // iterate backwards over lhs and rhs's children, starting from the last child
-    for (currLhsChild = lhs.firstChild->prevSibling, currRhsChild = rhs.firstChild->prevSibling;
-         // currLhsChild & currRhsChild aren't null and we haven't looped around
-         currLhsChild && currRhsChild && currLhsChild != lhs.firstChild;
-         currLhsChild = currLhsChild->prevSibling, currRhsChild = currRhsChild->prevSibling) {
+    // iterate forwards over lhs and rhs's children, starting from the second child, which goes
+    // through every instantiated child once, crossing the gap (if there is one) along the way
+    for (num i = 1; i < lhs.numChildrenInstantiated; i++) {
+        // the gap has to be in the same place
+        if (currLhsChild->isGapAfter() != currRhsChild->isGapAfter()) return false;
+        currLhsChild = currLhsChild->nextSibling;
+        currRhsChild = currRhsChild->nextSibling;
         // recursive call
         if (!areCellsCopies(*currLhsChild, *currRhsChild)) return false;
         // ensure parents are set correctly
         if (currLhsChild->getParent() != &lhs || currRhsChild->getParent() != &rhs) return false;
     }
-    // if one of them is null and the other isn't, return false
-    if ((currLhsChild && !currRhsChild) || (!currLhsChild && currRhsChild)) return false;
+    // and then back round to the first child
+    if (currLhsChild->nextSibling != lhs.firstChild || currRhsChild->nextSibling != rhs.firstChild) return false;
+    if (currLhsChild->isGapAfter() != currRhsChild->isGapAfter()) return false;
     // if we haven't returned by now, lhs and rhs must be equal
     return true;
 }
@@ -182,6 +206,7 @@ std::ostream& operator <<(std::ostream& out, spherehorn::Status status) {
         printEnumCase(Status::BREAK);
         printEnumCase(Status::EXIT);
         printEnumCase(Status::ABORT);
+        printEnumCase(Status::SUSPEND);
     }
     return out;
 }